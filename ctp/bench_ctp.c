@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "ctp.h"
+#include "ctp_timing.h"
+
+#define BENCH_ITERATIONS 2000
+
+// Payload moved per measurement, the iteration count follows from it
+#define BENCH_BYTES (8 * 1024 * 1024)
+#define BENCH_MIN_ITERATIONS 16
+
+// Enough for the frames of a 64 KB transfer in classic mode
+#define LOOPBACK_FRAMES 16384
+
+// Count heap allocations on glibc, the protocol is meant to never allocate
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+uint64_t allocations = 0;
+
+void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+#define ALLOCATIONS_COUNTED 1
+#else
+uint64_t allocations = 0;
+#define ALLOCATIONS_COUNTED 0
+#endif
+
+// Driver that drops every frame, so only the protocol cost is measured
+typedef struct {
+    uint64_t frames;
+    uint64_t checksum;
+} NullBus;
+
+bool null_send(void *handle, uint32_t id, const uint8_t *data, uint8_t length) {
+    NullBus *bus = handle;
+
+    // Touch the frame so the encoding can't be optimised away
+    bus->frames++;
+    bus->checksum += id + data[0] + data[length - 1] + length;
+    return true;
+}
+
+bool null_receive(void *handle, uint32_t *id, uint8_t *data, uint8_t *length) {
+    (void)handle;
+    (void)id;
+    (void)data;
+    (void)length;
+    return false;
+}
+
+uint32_t null_send_batch(void *handle, const CTP_CanFrame *frames, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        null_send(handle, frames[i].id, frames[i].data, frames[i].len);
+    }
+
+    return count;
+}
+
+// In-memory bus, frames sent are queued and received again in order. Rewind
+// read to replay the same frames.
+typedef struct {
+    CTP_CanFrame frames[LOOPBACK_FRAMES];
+    uint32_t count;
+    uint32_t read;
+} LoopbackBus;
+
+bool loopback_send(void *handle, uint32_t id, const uint8_t *data, uint8_t length) {
+    LoopbackBus *bus = handle;
+
+    if (bus->count == LOOPBACK_FRAMES) {
+        return false;
+    }
+
+    CTP_CanFrame *frame = &bus->frames[bus->count++];
+    frame->id = id;
+    frame->len = length;
+    memcpy(frame->data, data, length);
+    return true;
+}
+
+bool loopback_receive(void *handle, uint32_t *id, uint8_t *data, uint8_t *length) {
+    LoopbackBus *bus = handle;
+
+    if (bus->read == bus->count) {
+        return false;
+    }
+
+    CTP_CanFrame *frame = &bus->frames[bus->read++];
+    *id = frame->id;
+    *length = frame->len;
+    memcpy(data, frame->data, frame->len);
+    return true;
+}
+
+const CTP_Driver loopback_driver = {
+    .send = loopback_send,
+    .receive = loopback_receive,
+};
+
+const CTP_Driver null_driver = {
+    .send = null_send,
+    .receive = null_receive,
+};
+
+const CTP_Driver null_batch_driver = {
+    .send = null_send,
+    .receive = null_receive,
+    .send_batch = null_send_batch,
+};
+
+typedef uint32_t (*SendSequenceFn)(CTP_Context *ctx, uint32_t id, uint8_t *data, uint16_t length, bool fd);
+
+// Frame copy path: every chunk is staged in a CTP_Frame, then copied again
+// into a zeroed buffer by ctp_send_frame()
+uint32_t frame_copy_send_data_sequence(CTP_Context *ctx, uint32_t id, uint8_t *data, uint16_t length, bool fd) {
+    CTP_Frame frame;
+    frame.id = id;
+    uint8_t start_data_size = fd ? CTP_FD_START_DATA_SIZE : CTP_START_DATA_SIZE;
+    uint8_t end_data_size = fd ? CTP_FD_END_DATA_LENGTH : CTP_END_DATA_LENGTH;
+    uint8_t con_data_size = fd ? CTP_FD_CONSECUTIVE_DATA_LENGTH : CTP_CONSECUTIVE_DATA_LENGTH;
+
+    uint16_t start_frame_length = (length > start_data_size) ? start_data_size : length;
+
+    frame.type = CTP_START_FRAME;
+    frame.payload.start.payload_len = length;
+    memcpy(frame.payload.start.data, data, start_frame_length);
+    ctp_send_frame(ctx, &frame, (uint8_t)start_frame_length);
+
+    uint32_t bytes_sent = start_frame_length;
+    uint8_t sequence_number = 0;
+
+    while (bytes_sent < length) {
+        uint32_t bytes_left = length - bytes_sent;
+
+        if (bytes_left <= end_data_size) {
+            frame.type = CTP_END_FRAME;
+            memcpy(frame.payload.end.data, data + bytes_sent, bytes_left);
+        }
+        else {
+            frame.type = CTP_CONSECUTIVE_FRAME;
+            frame.payload.consecutive.sequence = sequence_number++;
+            memcpy(frame.payload.consecutive.data, data + bytes_sent, con_data_size);
+            bytes_left = con_data_size;
+        }
+
+        ctp_send_frame(ctx, &frame, bytes_left);
+        bytes_sent += bytes_left;
+    }
+
+    return bytes_sent;
+}
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Time stamp counter where there is one, 0 elsewhere
+uint64_t now_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+typedef struct {
+    uint64_t ns;
+    uint64_t cycles;
+    uint64_t allocations;
+} Measurement;
+
+void measure_start(Measurement *m) {
+    m->allocations = allocations;
+    m->cycles = now_cycles();
+    m->ns = now_ns();
+}
+
+void measure_stop(Measurement *m) {
+    m->ns = now_ns() - m->ns;
+    m->cycles = now_cycles() - m->cycles;
+    m->allocations = allocations - m->allocations;
+}
+
+void report(const char *name, uint32_t length, bool fd, const Measurement *m, uint64_t frames, uint64_t bytes) {
+    printf("  %-14s %6u B %s %9.2f ns/frame %8.2f Mframes/s %9.1f MB/s",
+           name, length, fd ? "FD     " : "classic", (double)m->ns / frames,
+           frames * 1000.0 / m->ns, bytes * 1000.0 / m->ns);
+
+    if (m->cycles != 0) {
+        printf(" %7.2f cycles/B", (double)m->cycles / bytes);
+    }
+    else {
+        printf("      n/a cycles/B");
+    }
+
+    if (ALLOCATIONS_COUNTED) {
+        printf(" %4llu allocs\n", (unsigned long long)m->allocations);
+    }
+    else {
+        printf("  n/a allocs\n");
+    }
+}
+
+uint32_t bench_iterations(uint32_t length) {
+    uint32_t iterations = BENCH_BYTES / length;
+
+    return (iterations < BENCH_MIN_ITERATIONS) ? BENCH_MIN_ITERATIONS : iterations;
+}
+
+// ctp_send() of length bytes into the loopback bus
+void bench_send(LoopbackBus *bus, uint8_t *data, uint32_t length, bool fd) {
+    CTP_Context ctx;
+    Measurement m;
+    uint64_t frames = 0;
+    uint32_t iterations = bench_iterations(length);
+
+    ctp_init(&ctx, &loopback_driver, bus);
+
+    measure_start(&m);
+    for (uint32_t i = 0; i < iterations; i++) {
+        bus->count = 0;
+        ctp_send(&ctx, 0x123, data, length, fd);
+        frames += bus->count;
+    }
+    measure_stop(&m);
+
+    report("ctp_send", length, fd, &m, frames, (uint64_t)length * iterations);
+}
+
+// ctp_receive() of length bytes, replaying the frames of one ctp_send()
+void bench_receive(LoopbackBus *bus, uint8_t *data, uint8_t *buffer, uint32_t length, bool fd) {
+    CTP_Context ctx;
+    Measurement m;
+    uint32_t iterations = bench_iterations(length);
+
+    ctp_init(&ctx, &loopback_driver, bus);
+    bus->count = 0;
+    ctp_send(&ctx, 0x123, data, length, fd);
+
+    measure_start(&m);
+    for (uint32_t i = 0; i < iterations; i++) {
+        bus->read = 0;
+        if (ctp_receive(&ctx, buffer, length, fd) != length) {
+            printf("  ctp_receive failed at %u B\n", length);
+            return;
+        }
+    }
+    measure_stop(&m);
+
+    if (memcmp(buffer, data, length) != 0) {
+        printf("  ctp_receive corrupted %u B\n", length);
+    }
+
+    report("ctp_receive", length, fd, &m, (uint64_t)bus->count * iterations, (uint64_t)length * iterations);
+}
+
+// ctp_send_frame() of full CONSECUTIVE frames to the null driver
+void bench_send_frame(bool fd) {
+    NullBus bus = {0};
+    CTP_Context ctx;
+    CTP_Frame frame;
+    Measurement m;
+    uint8_t length = fd ? CTP_FD_CONSECUTIVE_DATA_LENGTH : CTP_CONSECUTIVE_DATA_LENGTH;
+    uint32_t iterations = bench_iterations(length);
+
+    ctp_init(&ctx, &null_driver, &bus);
+    frame.id = 0x123;
+    frame.type = CTP_CONSECUTIVE_FRAME;
+    memset(frame.payload.consecutive.data, 0x55, sizeof(frame.payload.consecutive.data));
+
+    measure_start(&m);
+    for (uint32_t i = 0; i < iterations; i++) {
+        frame.payload.consecutive.sequence = (uint8_t)i;
+        ctp_send_frame(&ctx, &frame, length);
+    }
+    measure_stop(&m);
+
+    report("ctp_send_frame", length, fd, &m, bus.frames, (uint64_t)length * iterations);
+}
+
+// Returns the cost per frame in nanoseconds
+double bench_send_sequence(const char *name, const CTP_Driver *driver, SendSequenceFn fn, uint8_t *data, uint16_t length, bool fd) {
+    NullBus bus = {0};
+    CTP_Context ctx;
+
+    ctp_init(&ctx, driver, &bus);
+
+    // Warm up caches and branch predictors
+    fn(&ctx, 0x123, data, length, fd);
+    bus.frames = 0;
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        fn(&ctx, 0x123, data, length, fd);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    double ns_per_frame = (double)elapsed / bus.frames;
+    printf("  %-12s %6u B %s: %8.2f ns/frame %10.1f MB/s  (checksum %llx)\n",
+           name, length, fd ? "FD     " : "classic", ns_per_frame,
+           (double)length * BENCH_ITERATIONS * 1000.0 / elapsed, (unsigned long long)bus.checksum);
+
+    return ns_per_frame;
+}
+
+int main() {
+    static const uint32_t lengths[] = {1, 8, 64, 512, 4096, 65536};
+    static uint8_t data[65536];
+    static uint8_t buffer[65536];
+    static LoopbackBus bus;
+
+    for (uint32_t i = 0; i < sizeof(data); i++) {
+        data[i] = i * 31;
+    }
+
+    printf("Loopback throughput by payload size\n");
+
+    for (int fd = 0; fd <= 1; fd++) {
+        for (uint32_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+            bench_send(&bus, data, lengths[i], fd);
+            bench_receive(&bus, data, buffer, lengths[i], fd);
+        }
+        bench_send_frame(fd);
+    }
+
+    // What the bus allows for the same transfers, to hold the host side against
+    printf("Bus time by payload size, 500 kbit/s, FD data phase at 2 Mbit/s\n");
+
+    for (int fd = 0; fd <= 1; fd++) {
+        CTP_BusTiming timing = {.bitrate = 500000, .data_bitrate = fd ? 2000000 : 0, .fd = fd};
+
+        for (uint32_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+            CTP_TimingEstimate estimate;
+
+            ctp_timing_estimate(&timing, NULL, lengths[i], &estimate);
+            printf("  %6u B %s %6u frames %12.1f us %9.4f MB/s\n", lengths[i], fd ? "FD " : "CAN",
+                   estimate.frames, estimate.time_ns / 1e3, estimate.throughput / 1e6);
+        }
+    }
+
+    printf("ctp_send_data_sequence, largest single sequence\n");
+
+    for (int fd = 0; fd <= 1; fd++) {
+        uint16_t length = fd ? CTP_FD_MAX_SEQUENCE_LENGTH : CTP_MAX_SEQUENCE_LENGTH;
+
+        double copy = bench_send_sequence("frame copy", &null_driver, frame_copy_send_data_sequence, data, length, fd);
+        double encoder = bench_send_sequence("encoder", &null_driver, ctp_send_data_sequence, data, length, fd);
+        double batch = bench_send_sequence("batched", &null_batch_driver, ctp_send_data_sequence, data, length, fd);
+
+        printf("  encoder speedup: %.2fx, batched: %.2fx\n", copy / encoder, copy / batch);
+    }
+
+    return 0;
+}
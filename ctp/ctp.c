@@ -1,11 +1,403 @@
-#include <stdio.h>
 #include <string.h>
 
 #include "ctp.h"
 
 
+void ctp_init(CTP_Context *ctx, const CTP_Driver *driver, void *handle) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->driver = driver;
+    ctx->handle = handle;
+    ctx->padding.value = CTP_PADDING_BYTE;
+    ctp_stats_reset(ctx);
+}
+
+static inline void ctp_stat_add(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+// Count a frame by its type byte, frames of unknown types only count as bytes.
+// Compact frames count as CONSECUTIVE frames, the last one included.
+static inline void ctp_stat_frame(_Atomic uint64_t *frames, _Atomic uint64_t *bytes, const uint8_t *data, uint8_t len) {
+    if (len > 0 && data[0] < CTP_FRAME_TYPE_COUNT) {
+        ctp_stat_add(&frames[data[0]], 1);
+    }
+    else if (len > 0 && (data[0] & CTP_COMPACT_PCI_MASK) == CTP_COMPACT_PCI) {
+        ctp_stat_add(&frames[CTP_CONSECUTIVE_FRAME], 1);
+    }
+    ctp_stat_add(bytes, len);
+}
+
+// Frames of a burst are tallied locally and added to the counters once, one
+// atomic add per counter instead of two per frame
+typedef struct {
+    uint64_t frames[CTP_FRAME_TYPE_COUNT];
+    uint64_t bytes;
+} CTP_StatTally;
+
+static inline void ctp_stat_tally(CTP_StatTally *tally, const uint8_t *data, uint8_t len) {
+    if (len > 0 && data[0] < CTP_FRAME_TYPE_COUNT) {
+        tally->frames[data[0]]++;
+    }
+    else if (len > 0 && (data[0] & CTP_COMPACT_PCI_MASK) == CTP_COMPACT_PCI) {
+        tally->frames[CTP_CONSECUTIVE_FRAME]++;
+    }
+    tally->bytes += len;
+}
+
+static inline void ctp_stat_flush(_Atomic uint64_t *frames, _Atomic uint64_t *bytes, const CTP_StatTally *tally) {
+    for (uint32_t i = 0; i < CTP_FRAME_TYPE_COUNT; i++) {
+        if (tally->frames[i] != 0) {
+            ctp_stat_add(&frames[i], tally->frames[i]);
+        }
+    }
+    if (tally->bytes != 0) {
+        ctp_stat_add(bytes, tally->bytes);
+    }
+}
+
+// All frames leave through here so they are counted, the caller has padded
+// them already
+static bool ctp_driver_send_padded(CTP_Context *ctx, uint32_t id, const uint8_t *data, uint8_t len) {
+    if (!ctx->driver->send(ctx->handle, id, data, len)) {
+        return false;
+    }
+
+    ctp_stat_frame(ctx->stats.frames_tx, &ctx->stats.bytes_tx, data, len);
+    return true;
+}
+
+// Same as ctp_driver_send_padded() for frames not padded by the encoder, they
+// are padded on the way
+static bool ctp_driver_send(CTP_Context *ctx, uint32_t id, const uint8_t *data, uint8_t len) {
+    uint8_t padded[CAN_MAX_DATA_LENGTH];
+
+    if (ctp_padded_length(&ctx->padding, len) != len) {
+        memcpy(padded, data, len);
+        len = ctp_pad_frame(&ctx->padding, padded, len);
+        data = padded;
+    }
+
+    return ctp_driver_send_padded(ctx, id, data, len);
+}
+
+// Copy the counters. Each one is read atomically, but the snapshot as a whole
+// isn't, counters may move while it is taken.
+void ctp_stats_snapshot(CTP_Context *ctx, CTP_StatsSnapshot *snapshot) {
+    CTP_Stats *stats = &ctx->stats;
+
+    for (uint32_t i = 0; i < CTP_FRAME_TYPE_COUNT; i++) {
+        snapshot->frames_tx[i] = atomic_load_explicit(&stats->frames_tx[i], memory_order_relaxed);
+        snapshot->frames_rx[i] = atomic_load_explicit(&stats->frames_rx[i], memory_order_relaxed);
+    }
+    snapshot->bytes_tx = atomic_load_explicit(&stats->bytes_tx, memory_order_relaxed);
+    snapshot->bytes_rx = atomic_load_explicit(&stats->bytes_rx, memory_order_relaxed);
+    snapshot->completed = atomic_load_explicit(&stats->completed, memory_order_relaxed);
+    snapshot->sequence_errors = atomic_load_explicit(&stats->sequence_errors, memory_order_relaxed);
+    snapshot->overflows = atomic_load_explicit(&stats->overflows, memory_order_relaxed);
+    snapshot->timeouts = atomic_load_explicit(&stats->timeouts, memory_order_relaxed);
+    snapshot->aborted = atomic_load_explicit(&stats->aborted, memory_order_relaxed);
+    snapshot->filtered = atomic_load_explicit(&stats->filtered, memory_order_relaxed);
+
+    for (uint32_t i = 0; i < CTP_LATENCY_BUCKETS; i++) {
+        snapshot->latency_us[i] = atomic_load_explicit(&stats->latency_us[i], memory_order_relaxed);
+    }
+}
+
+void ctp_stats_reset(CTP_Context *ctx) {
+    CTP_Stats *stats = &ctx->stats;
+
+    for (uint32_t i = 0; i < CTP_FRAME_TYPE_COUNT; i++) {
+        atomic_store_explicit(&stats->frames_tx[i], 0, memory_order_relaxed);
+        atomic_store_explicit(&stats->frames_rx[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&stats->bytes_tx, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->bytes_rx, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->completed, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->sequence_errors, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->overflows, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->timeouts, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->aborted, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->filtered, 0, memory_order_relaxed);
+
+    for (uint32_t i = 0; i < CTP_LATENCY_BUCKETS; i++) {
+        atomic_store_explicit(&stats->latency_us[i], 0, memory_order_relaxed);
+    }
+}
+
+// Current time of the context's clock, 0 when the driver has none
+static uint64_t ctp_now_us(CTP_Context *ctx) {
+    if (ctx == NULL || ctx->driver->now_us == NULL) {
+        return 0;
+    }
+
+    return ctx->driver->now_us(ctx->handle);
+}
+
+// Extended ID of a J1939 address. PDU1 PGNs get the destination address in
+// PS, for PDU2 PGNs PS is part of the PGN and the destination is ignored.
+uint32_t ctp_j1939_id(const CTP_J1939Address *address) {
+    uint32_t pgn = address->pgn & 0x3FFFF;
+
+    if (((pgn >> 8) & 0xFF) < CTP_J1939_PDU2_FORMAT) {
+        pgn = (pgn & 0x3FF00) | address->destination;
+    }
+
+    return CTP_ID_EXTENDED | ((uint32_t)(address->priority & 0x7) << 26) | (pgn << 8) | address->source;
+}
+
+CTP_J1939Address ctp_j1939_address(uint32_t id) {
+    CTP_J1939Address address;
+
+    address.priority = (id >> 26) & 0x7;
+    address.pgn = (id >> 8) & 0x3FFFF;
+    address.source = id & 0xFF;
+    address.destination = CTP_J1939_GLOBAL_ADDRESS;
+
+    if (((address.pgn >> 8) & 0xFF) < CTP_J1939_PDU2_FORMAT) {
+        address.destination = address.pgn & 0xFF;
+        address.pgn &= 0x3FF00;
+    }
+
+    return address;
+}
+
+// ID the peer answers on, e.g. the flow control ID of a sequence sent on id:
+// the same PGN and priority with source and destination swapped. PDU2 IDs
+// have no destination, they are returned as they are.
+uint32_t ctp_j1939_reply_id(uint32_t id) {
+    CTP_J1939Address address = ctp_j1939_address(id);
+
+    if (((address.pgn >> 8) & 0xFF) >= CTP_J1939_PDU2_FORMAT) {
+        return id;
+    }
+
+    uint8_t source = address.source;
+    address.source = address.destination;
+    address.destination = source;
+    return ctp_j1939_id(&address);
+}
+
+static inline bool ctp_filter_standard(const CTP_Filter *filter, uint32_t id) {
+    return (filter->standard[id / 32] >> (id % 32)) & 1;
+}
+
+bool ctp_filter_match(const CTP_Filter *filter, uint32_t id) {
+    if (!filter->enabled) {
+        return true;
+    }
+
+    if (!CTP_ID_IS_EXTENDED(id)) {
+        return id <= CTP_STANDARD_ID_MAX && ctp_filter_standard(filter, id);
+    }
+
+    id &= CTP_EXTENDED_ID_MAX;
+
+    uint32_t low = 0;
+    uint32_t high = filter->extended_count;
+
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+
+        if (id < filter->extended[mid].first) {
+            high = mid;
+        }
+        else if (id > filter->extended[mid].last) {
+            low = mid + 1;
+        }
+        else {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Append a range, once ranges is full the last one grows to cover the rest
+static uint32_t ctp_filter_push_range(CTP_IdRange *ranges, uint32_t count, uint32_t max_ranges, uint32_t first, uint32_t last) {
+    if (count < max_ranges) {
+        ranges[count].first = first;
+        ranges[count].last = last;
+        return count + 1;
+    }
+
+    ranges[count - 1].last = last;
+    return count;
+}
+
+// Ranges covering every accepted ID for drivers to program their filters
+// with, 11 bit ranges first, each format in ascending order. When more than
+// max_ranges are needed they cover a superset, the software filter drops the
+// rest. Returns 0 when every ID is accepted.
+uint32_t ctp_filter_ranges(const CTP_Filter *filter, CTP_IdRange *ranges, uint32_t max_ranges) {
+    uint32_t count = 0;
+
+    // A range can't cover both formats, each one needs a range of its own
+    if (!filter->enabled || max_ranges < 2) {
+        return 0;
+    }
+
+    uint32_t max_standard = (filter->extended_count > 0) ? max_ranges - 1 : max_ranges;
+
+    // Runs of 11 bit IDs in the bitmap
+    for (uint32_t id = 0; id <= CTP_STANDARD_ID_MAX; id++) {
+        if (!ctp_filter_standard(filter, id)) {
+            continue;
+        }
+
+        uint32_t first = id;
+
+        while (id < CTP_STANDARD_ID_MAX && ctp_filter_standard(filter, id + 1)) {
+            id++;
+        }
+        count = ctp_filter_push_range(ranges, count, max_standard, first, id);
+    }
+
+    CTP_IdRange *extended = &ranges[count];
+    uint32_t extended_count = 0;
+
+    for (uint32_t i = 0; i < filter->extended_count; i++) {
+        extended_count = ctp_filter_push_range(extended, extended_count, max_ranges - count,
+                                               CTP_ID_EXTENDED | filter->extended[i].first,
+                                               CTP_ID_EXTENDED | filter->extended[i].last);
+    }
+
+    return count + extended_count;
+}
+
+// Hand the filter to the driver. A driver that can't take it keeps passing
+// more than asked, which the software filter in ctp_read_frame() catches.
+static void ctp_filter_apply(CTP_Context *ctx) {
+    CTP_IdRange ranges[CTP_FILTER_MAX_RANGES];
+
+    if (ctx->driver->set_filter == NULL) {
+        return;
+    }
+
+    uint32_t count = ctp_filter_ranges(&ctx->filter, ranges, CTP_FILTER_MAX_RANGES);
+    ctx->driver->set_filter(ctx->handle, count > 0 ? ranges : NULL, count);
+}
+
+// Insert a 29 bit range, merging it with the ranges it overlaps or touches
+static bool ctp_filter_insert_extended(CTP_Filter *filter, uint32_t first, uint32_t last) {
+    CTP_IdRange *ranges = filter->extended;
+    uint32_t count = filter->extended_count;
+    uint32_t i = 0;
+    uint32_t j;
+
+    // Ranges i to j - 1 merge with the new one
+    while (i < count && ranges[i].last + 1 < first) {
+        i++;
+    }
+    for (j = i; j < count && ranges[j].first <= last + 1; j++) {
+    }
+
+    if (i == j) {
+        if (count == CTP_FILTER_MAX_RANGES) {
+            return false;
+        }
+
+        memmove(&ranges[i + 1], &ranges[i], (count - i) * sizeof(ranges[0]));
+        ranges[i].first = first;
+        ranges[i].last = last;
+        filter->extended_count++;
+        return true;
+    }
+
+    ranges[i].first = (ranges[i].first < first) ? ranges[i].first : first;
+    ranges[i].last = (ranges[j - 1].last > last) ? ranges[j - 1].last : last;
+    memmove(&ranges[i + 1], &ranges[j], (count - j) * sizeof(ranges[0]));
+    filter->extended_count -= j - i - 1;
+    return true;
+}
+
+// Accept the IDs first to last, both of the same format. Until the first
+// range is added a context accepts every ID, afterwards only the added ones,
+// so flow control IDs have to be added as well. Returns false when the range
+// is invalid or there is no room for another 29 bit range, the filter is
+// unchanged then.
+bool ctp_filter_add_range(CTP_Context *ctx, uint32_t first, uint32_t last) {
+    CTP_Filter *filter = &ctx->filter;
+
+    if (first > last || CTP_ID_IS_EXTENDED(first) != CTP_ID_IS_EXTENDED(last)) {
+        return false;
+    }
+
+    if (CTP_ID_IS_EXTENDED(first)) {
+        if ((last & ~CTP_ID_EXTENDED) > CTP_EXTENDED_ID_MAX ||
+            !ctp_filter_insert_extended(filter, first & CTP_EXTENDED_ID_MAX, last & CTP_EXTENDED_ID_MAX)) {
+            return false;
+        }
+    }
+    else {
+        if (last > CTP_STANDARD_ID_MAX) {
+            return false;
+        }
+
+        for (uint32_t id = first; id <= last; id++) {
+            filter->standard[id / 32] |= 1u << (id % 32);
+        }
+    }
+
+    filter->enabled = true;
+    ctp_filter_apply(ctx);
+    return true;
+}
+
+bool ctp_filter_add(CTP_Context *ctx, uint32_t id) {
+    return ctp_filter_add_range(ctx, id, id);
+}
+
+// Accept every ID again
+void ctp_filter_clear(CTP_Context *ctx) {
+    memset(&ctx->filter, 0, sizeof(ctx->filter));
+    ctp_filter_apply(ctx);
+}
+
+// Next frame from the driver, through the read-ahead buffer when the driver
+// supports batched receive
+static bool ctp_read_driver_frame(CTP_Context *ctx, CTP_CanFrame *frame) {
+    const CTP_Driver *driver = ctx->driver;
 
-void ctp_send_frame(const CTP_Frame *frame, uint8_t len) {
+    if (driver->receive_batch == NULL) {
+        frame->timestamp_us = 0;
+
+        if (!driver->receive(ctx->handle, &frame->id, frame->data, &frame->len)) {
+            return false;
+        }
+    }
+    else {
+        if (ctx->rx_batch_pos == ctx->rx_batch_count) {
+            ctx->rx_batch_pos = 0;
+            ctx->rx_batch_count = driver->receive_batch(ctx->handle, ctx->rx_batch, CTP_RX_BATCH_SIZE);
+
+            if (ctx->rx_batch_count == 0) {
+                return false;
+            }
+        }
+
+        *frame = ctx->rx_batch[ctx->rx_batch_pos++];
+    }
+
+    return true;
+}
+
+// Read the next frame the acceptance filter lets through, going through the
+// read-ahead buffer when the driver supports batched receive. Returns false
+// when no frame is available right now.
+bool ctp_read_frame(CTP_Context *ctx, CTP_CanFrame *frame) {
+    while (ctp_read_driver_frame(ctx, frame)) {
+        if (ctp_filter_match(&ctx->filter, frame->id)) {
+            ctp_stat_frame(ctx->stats.frames_rx, &ctx->stats.bytes_rx, frame->data, frame->len);
+            return true;
+        }
+
+        ctp_stat_add(&ctx->stats.filtered, 1);
+    }
+
+    return false;
+}
+
+void ctp_send_frame(CTP_Context *ctx, const CTP_Frame *frame, uint8_t len) {
     // Convert the CTP frame to raw CAN data
     uint8_t can_data[CAN_MAX_DATA_LENGTH] = {0};
     uint8_t length = 0;
@@ -29,128 +421,342 @@ void ctp_send_frame(const CTP_Frame *frame, uint8_t len) {
             break;
         case CTP_ERROR_FRAME:
             can_data[1] = frame->payload.error.errorCode;
-            length = 2;
+            memcpy(&can_data[2], frame->payload.error.data, len);
+            length = len + 2;
+            break;
+        case CTP_FLOW_CONTROL_FRAME:
+            can_data[1] = frame->payload.flow_control.status;
+            can_data[2] = frame->payload.flow_control.block_size;
+            can_data[3] = frame->payload.flow_control.st_min;
+            length = CTP_FLOW_CONTROL_FRAME_LENGTH;
             break;
         default:
             break;
     }
     
-    send_ctp_message(frame->id, can_data, length);
+    ctp_driver_send(ctx, frame->id, can_data, length);
 }
 
-// This function can only receive 2^16 or 0xFFFF bytes, because of the protocol
-// payload_len field is 16bits, for larger data size use ctp_receive 
-int32_t ctp_receive_seq(uint8_t* buffer, uint32_t buffer_size, bool fd) {
-    uint8_t can_data[CAN_MAX_DATA_LENGTH] = {0};
-    uint8_t length;
-    uint32_t received_length = 0;
-    uint8_t expected_sequence_number = 0;
-    uint32_t expected_total_length = 0;
-    bool start_frame_received = false;
-    uint32_t can_id;
-    uint8_t frame_type;
+void ctp_rx_init(CTP_Receiver *rx, CTP_Context *ctx, uint8_t *buffer, uint32_t buffer_size, bool fd) {
+    rx->ctx = ctx;
+    rx->buffer = buffer;
+    rx->buffer_size = buffer_size;
+    rx->sink = NULL;
+    rx->sink_user = NULL;
+    rx->fd = fd;
+    ctp_rx_reset(rx);
+}
 
-    uint8_t start_data_size;
-    uint8_t con_data_size;
+// Hand the payload to sink as it arrives instead of reassembling it in a
+// buffer, so sequences of any length are received in constant memory
+void ctp_rx_init_sink(CTP_Receiver *rx, CTP_Context *ctx, CTP_Sink sink, void *user, bool fd) {
+    ctp_rx_init(rx, ctx, NULL, UINT32_MAX, fd);
+    rx->sink = sink;
+    rx->sink_user = user;
+}
 
-    if (fd) {
-        start_data_size = CTP_FD_START_DATA_SIZE;
-        con_data_size = CTP_FD_CONSECUTIVE_DATA_LENGTH;
+void ctp_rx_reset(CTP_Receiver *rx) {
+    rx->id = 0;
+    rx->received_length = 0;
+    rx->expected_total_length = 0;
+    rx->start_length = 0;
+    rx->flags = 0;
+    rx->trailer_length = 0;
+    rx->crc = 0;
+    rx->crc_late = 0;
+    rx->deadline_us = 0;
+    rx->start_us = 0;
+    memset(&rx->timing, 0, sizeof(rx->timing));
+    rx->consecutive_frames = 0;
+    rx->next_frame = 0;
+    rx->missing_count = 0;
+    memset(rx->missing, 0, sizeof(rx->missing));
+    rx->block_count = 0;
+    rx->start_frame_received = false;
+    rx->end_received = false;
+    rx->done = false;
+}
+
+static bool ctp_rx_wants_flow_control(const CTP_FlowControl *fc, CTP_FlowStatus status) {
+    switch (status) {
+        case CTP_FC_COMPLETE:
+            return fc->retransmit;      // Only retransmitting senders wait for it
+        case CTP_FC_OVERFLOW:
+            return fc->enabled || fc->retransmit;
+        default:
+            return fc->enabled;
     }
-    else {
-        start_data_size = CTP_START_DATA_SIZE;
-        con_data_size = CTP_CONSECUTIVE_DATA_LENGTH;
+}
+
+// Answer the sender when flow control or retransmission is enabled on the
+// receiver's channel
+static void ctp_rx_flow_control(CTP_Receiver *rx, CTP_FlowStatus status) {
+    CTP_Context *ctx = rx->ctx;
+
+    if (ctx == NULL || !ctp_rx_wants_flow_control(&ctx->flow_control, status)) {
+        return;
+    }
+
+    CTP_Frame frame;
+    frame.id = ctx->flow_control.tx_id;
+    frame.type = CTP_FLOW_CONTROL_FRAME;
+    frame.payload.flow_control.status = status;
+    frame.payload.flow_control.block_size = ctx->flow_control.block_size;
+    frame.payload.flow_control.st_min = ctx->flow_control.st_min;
+    ctp_send_frame(ctx, &frame, 0);
+}
+
+// Compact sequence numbers are too short to name a lost frame
+static bool ctp_rx_retransmit(const CTP_Receiver *rx) {
+    return rx->ctx != NULL && rx->ctx->flow_control.retransmit && !(rx->flags & CTP_EXT_FLAG_COMPACT);
+}
+
+// Record a lost CONSECUTIVE frame and ask the sender for it. Fails when the
+// frame a full window back is still missing, its slot can't be reused.
+static bool ctp_rx_nack(CTP_Receiver *rx, uint32_t index) {
+    uint32_t slot = index % CTP_RETRANSMIT_WINDOW;
+    uint32_t bit = 1u << (slot % 32);
+
+    if (rx->missing[slot / 32] & bit) {
+        return false;
+    }
+    rx->missing[slot / 32] |= bit;
+    rx->missing_count++;
+
+    // The CRC runs over the sequence in order, count the lost frame as zeros
+    // until it arrives
+    if (rx->flags & CTP_EXT_FLAG_CRC32) {
+        static const uint8_t zeros[CTP_FD_CONSECUTIVE_DATA_LENGTH];
+        uint8_t con_data_size = rx->fd ? CTP_FD_CONSECUTIVE_DATA_LENGTH : CTP_CONSECUTIVE_DATA_LENGTH;
+        uint32_t offset = rx->start_length + index * con_data_size;
+
+        if (offset < rx->expected_total_length) {
+            uint32_t n = rx->expected_total_length - offset;
+            rx->crc = ctp_crc32(rx->crc, zeros, (n > con_data_size) ? con_data_size : n);
+        }
     }
 
-    while (received_length < expected_total_length || !start_frame_received) {
-        if (!receive_ctp_message(&can_id, can_data, &length)) {
-            continue;  // Keep trying until we get a message or reach timeout
+    CTP_Frame frame;
+    frame.id = rx->ctx->flow_control.tx_id;
+    frame.type = CTP_ERROR_FRAME;
+    frame.payload.error.errorCode = CTP_INVALID_SEQUENCE_NUMBER;
+    frame.payload.error.data[0] = (uint8_t)index;
+    ctp_send_frame(rx->ctx, &frame, 1);
+
+    return true;
+}
+
+// Clear a missing frame, returns false if it wasn't missing
+static bool ctp_rx_recover(CTP_Receiver *rx, uint32_t index) {
+    uint32_t slot = index % CTP_RETRANSMIT_WINDOW;
+    uint32_t bit = 1u << (slot % 32);
+
+    if (!(rx->missing[slot / 32] & bit)) {
+        return false;
+    }
+    rx->missing[slot / 32] &= ~bit;
+    rx->missing_count--;
+
+    return true;
+}
+
+// Count frames towards the current block, granting the next one when it's full
+static void ctp_rx_count_block(CTP_Receiver *rx, uint32_t frames) {
+    if (rx->ctx == NULL || rx->ctx->flow_control.block_size == 0) {
+        return;
+    }
+
+    while (frames-- > 0) {
+        if (++rx->block_count == rx->ctx->flow_control.block_size) {
+            rx->block_count = 0;
+            ctp_rx_flow_control(rx, CTP_FC_CONTINUE);
         }
+    }
+}
 
-        frame_type = can_data[0];
+static CTP_RxStatus ctp_rx_fail(CTP_Receiver *rx, CTP_ErrorCode error) {
+    rx->error = error;
+    rx->done = true;
 
-        if (!start_frame_received && frame_type == CTP_START_FRAME) {
-            expected_total_length = (can_data[1] << 8) | can_data[2];
+    if (rx->ctx != NULL) {
+        switch (error) {
+            case CTP_MESSAGE_TIMEOUT:
+                ctp_stat_add(&rx->ctx->stats.timeouts, 1);
+                break;
+            case CTP_INVALID_SEQUENCE_NUMBER:
+                ctp_stat_add(&rx->ctx->stats.sequence_errors, 1);
+                break;
+            default:
+                ctp_stat_add(&rx->ctx->stats.aborted, 1);
+                break;
+        }
+    }
 
-            if (expected_total_length > buffer_size) {
-                printf("Buffer provided is not enough: expected_total_length=%u, buffer_size=%u\n", 
-                        expected_total_length, buffer_size);
-                return -1;  // Error: buffer provided is not enough
-            }
+    return CTP_RX_ERROR;
+}
+
+// The sequence doesn't fit the buffer or runs past its announced length
+static CTP_RxStatus ctp_rx_overflow(CTP_Receiver *rx) {
+    if (rx->ctx != NULL) {
+        ctp_stat_add(&rx->ctx->stats.overflows, 1);
+    }
+
+    return ctp_rx_fail(rx, CTP_INVALID_FRAME_LENGTH);
+}
 
-            uint8_t start_frame_length = (expected_total_length > start_data_size) ? start_data_size : expected_total_length;
+// Store n bytes of the sequence at offset, bytes past the payload belong to the
+// trailer. late marks a retransmitted frame that arrives behind newer ones.
+// Returns false when the sink aborts.
+static bool ctp_rx_store(CTP_Receiver *rx, uint32_t offset, const uint8_t *src, uint32_t n, bool late) {
+    uint32_t head = 0;
 
-            memcpy(buffer, &can_data[3], start_frame_length);
-            received_length += start_frame_length;
-            start_frame_received = true;
+    if (offset < rx->expected_total_length) {
+        head = rx->expected_total_length - offset;
+        head = (head > n) ? n : head;
 
-            if (expected_total_length == start_frame_length) {
-                return received_length;
+        if (rx->sink != NULL) {
+            if (!rx->sink(rx->sink_user, offset, src, head)) {
+                return false;
             }
-            
-            continue;
         }
+        else {
+            memcpy(&rx->buffer[offset], src, head);
+        }
+        rx->received_length += head;
 
-        if (start_frame_received) {
-            uint32_t bytes_left = expected_total_length - received_length;
-            
-            switch (frame_type) {
-                case CTP_CONSECUTIVE_FRAME:
-                    if (can_data[1] != expected_sequence_number) {
-                        printf("Expected sequence number %u but received %u\n", expected_sequence_number, can_data[1]);
-                        return -1;  // Error: sequence mismatch
-                    }
-                    if ((received_length + con_data_size) > buffer_size) {
-                        printf("Buffer overflow: received_length=%u, buffer_size=%u\n", received_length, buffer_size);
-                        return -1;  // Error: buffer overflow
-                    }
-                    memcpy(&buffer[received_length], &can_data[2], con_data_size);
-                    received_length += con_data_size;
-                    expected_sequence_number++;
-                    break;
+        if (rx->flags & CTP_EXT_FLAG_CRC32) {
+            if (late) {
+                rx->crc_late ^= ctp_crc32_shift(~ctp_crc32(~0u, src, head), rx->expected_total_length - offset - head);
+            }
+            else {
+                rx->crc = ctp_crc32(rx->crc, src, head);
+            }
+        }
+    }
 
-                case CTP_END_FRAME:
-                    if ((received_length + bytes_left) > buffer_size) {
-                        printf("Buffer overflow: received_length=%u, buffer_size=%u\n", received_length, buffer_size);
-                        return -1;  // Error: buffer overflow
-                    }
-                    memcpy(&buffer[received_length], &can_data[1], bytes_left);
-                    received_length += bytes_left;
-                    return received_length;  // Successfully received the full frame
+    if (head < n) {
+        memcpy(&rx->trailer[offset + head - rx->expected_total_length], src + head, n - head);
+    }
 
-                default:
-                    // In case of unexpected frame type, keep trying
-                    break;
+    return true;
+}
+
+// Restart the N_Cr timer after a frame of the sequence arrived
+static void ctp_rx_arm(CTP_Receiver *rx) {
+    if (rx->ctx == NULL || rx->ctx->timeouts.frame_us == 0) {
+        return;
+    }
+
+    uint64_t now = ctp_now_us(rx->ctx);
+
+    if (now != 0) {
+        rx->deadline_us = now + rx->ctx->timeouts.frame_us;
+    }
+}
+
+// Fail the sequence in progress with CTP_MESSAGE_TIMEOUT when its next frame is
+// overdue. Call it periodically, ctp_rx_feed() only runs when frames arrive.
+// Returns true if the sequence timed out.
+bool ctp_rx_expire(CTP_Receiver *rx) {
+    if (rx->done || !rx->start_frame_received || rx->deadline_us == 0) {
+        return false;
+    }
+
+    if (ctp_now_us(rx->ctx) < rx->deadline_us) {
+        return false;
+    }
+
+    ctp_rx_fail(rx, CTP_MESSAGE_TIMEOUT);
+    return true;
+}
+
+static CTP_RxStatus ctp_rx_complete(CTP_Receiver *rx) {
+    if (rx->flags & CTP_EXT_FLAG_CRC32) {
+        uint32_t crc = ((uint32_t)rx->trailer[0] << 24) | ((uint32_t)rx->trailer[1] << 16) |
+                       ((uint32_t)rx->trailer[2] << 8) | rx->trailer[3];
+
+        if ((rx->crc ^ rx->crc_late) != crc) {
+            return ctp_rx_fail(rx, CTP_INVALID_CHECKSUM);
+        }
+    }
+
+    rx->done = true;
+
+    if (rx->ctx != NULL) {
+        ctp_stat_add(&rx->ctx->stats.completed, 1);
+
+        // Frame timestamps are closer to the wire than the driver's clock
+        uint64_t start_us = rx->timing.first_us ? rx->timing.first_us : rx->start_us;
+        uint64_t end_us = rx->timing.first_us ? rx->timing.last_us : ctp_now_us(rx->ctx);
+
+        if (start_us != 0) {
+            uint64_t latency = end_us - start_us;
+            uint32_t bucket = 0;
+
+            while (latency > 0 && bucket < CTP_LATENCY_BUCKETS - 1) {
+                latency >>= 1;
+                bucket++;
             }
+            ctp_stat_add(&rx->ctx->stats.latency_us[bucket], 1);
         }
     }
 
-    return -1;  // Should not reach here unless there's an error
+    ctp_rx_flow_control(rx, CTP_FC_COMPLETE);
+    return CTP_RX_COMPLETE;
 }
 
-// Receive length bytes, and store it in the buffer.
-int32_t ctp_receive(uint8_t *buffer, uint32_t length, bool fd) {
-    uint32_t bytes_received = 0;
-    
-    while (bytes_received < length) {
-         bytes_received += ctp_receive_seq(buffer + bytes_received, length - bytes_received, fd);
+// Account a frame of the sequence to its timing, timestamp_us is 0 when
+// the driver provides none
+static void ctp_rx_stamp(CTP_Receiver *rx, uint64_t timestamp_us) {
+    CTP_RxTiming *timing = &rx->timing;
 
-         if (bytes_received < 0) {
-             return -1;
-         }
+    timing->frames++;
+
+    if (timestamp_us == 0) {
+        return;
     }
 
-    return bytes_received;
+    if (timing->first_us == 0) {
+        timing->first_us = timestamp_us;
+    }
+    else if (timestamp_us > timing->last_us && timestamp_us - timing->last_us > timing->max_gap_us) {
+        timing->max_gap_us = timestamp_us - timing->last_us;
+    }
+    timing->last_us = timestamp_us;
 }
 
-uint32_t ctp_send_data_sequence(uint32_t id, uint8_t *data, uint16_t length, bool fd) {
-    CTP_Frame frame;
-    frame.id = id;
+static CTP_RxStatus ctp_rx_feed_at(CTP_Receiver *rx, uint32_t id, const uint8_t *data, uint8_t len, uint64_t timestamp_us);
+
+// Feed one CAN frame to the receiver. Frames that don't belong to the sequence
+// in progress are ignored. After CTP_RX_COMPLETE or CTP_RX_ERROR the next
+// START frame begins a new sequence. Extended START frames are accepted the
+// same way, so a sequence may be up to 4 GB long. With retransmission enabled a gap in the
+// sequence numbers is NACKed and the sequence completes once every missing
+// frame has been resent, otherwise it fails the sequence.
+CTP_RxStatus ctp_rx_feed(CTP_Receiver *rx, uint32_t id, const uint8_t *data, uint8_t len) {
+    return ctp_rx_feed_at(rx, id, data, len, 0);
+}
+
+// Same as ctp_rx_feed() for a frame read from the driver, its receive
+// timestamp goes into rx->timing
+CTP_RxStatus ctp_rx_feed_frame(CTP_Receiver *rx, const CTP_CanFrame *frame) {
+    return ctp_rx_feed_at(rx, frame->id, frame->data, frame->len, frame->timestamp_us);
+}
+
+static CTP_RxStatus ctp_rx_feed_at(CTP_Receiver *rx, uint32_t id, const uint8_t *data, uint8_t len, uint64_t timestamp_us) {
     uint8_t start_data_size;
     uint8_t end_data_size;
     uint8_t con_data_size;
 
-    if (fd) {
+    if (len == 0) {
+        return CTP_RX_IN_PROGRESS;
+    }
+
+    if (rx->done) {
+        ctp_rx_reset(rx);
+    }
+
+    if (rx->fd) {
         start_data_size = CTP_FD_START_DATA_SIZE;
         end_data_size = CTP_FD_END_DATA_LENGTH;
         con_data_size = CTP_FD_CONSECUTIVE_DATA_LENGTH;
@@ -160,40 +766,1042 @@ uint32_t ctp_send_data_sequence(uint32_t id, uint8_t *data, uint16_t length, boo
         end_data_size = CTP_END_DATA_LENGTH;
         con_data_size = CTP_CONSECUTIVE_DATA_LENGTH;
     }
-    
-    uint16_t start_frame_length = (length > (start_data_size)) ? (start_data_size) : length;
 
-    // Set up and send the START frame
-    frame.type = CTP_START_FRAME;
-    frame.payload.start.payload_len = length;
-    memcpy(frame.payload.start.data, data, start_frame_length);
-    ctp_send_frame(&frame, (uint8_t)start_frame_length);
+    uint8_t frame_type = data[0];
+    uint8_t flags = rx->flags;
 
-    uint32_t bytes_sent = start_frame_length;
-    uint8_t sequence_number = 0;
-
-    while (bytes_sent < length) {
-        uint32_t bytes_left = length - bytes_sent;
+    if (!rx->start_frame_received) {
+        flags = (frame_type == CTP_EXT_START_FRAME && len >= CTP_EXT_START_FRAME_HEADER_SIZE) ? data[1] : 0;
+    }
 
-        if (bytes_left <= (end_data_size)) {
-            frame.type = CTP_END_FRAME;
-            memcpy(frame.payload.end.data, data + bytes_sent, bytes_left);
-        } 
-        else {
-            frame.type = CTP_CONSECUTIVE_FRAME;
-            frame.payload.consecutive.sequence = sequence_number++;
-            memcpy(frame.payload.consecutive.data, data + bytes_sent, con_data_size);
-            bytes_left = con_data_size;
-        }
-        
-        ctp_send_frame(&frame, bytes_left);
-        bytes_sent += bytes_left;
+    // Every compact frame is full but the last one
+    if (flags & CTP_EXT_FLAG_COMPACT) {
+        con_data_size = rx->fd ? CTP_FD_COMPACT_DATA_LENGTH : CTP_COMPACT_DATA_LENGTH;
+        end_data_size = con_data_size;
     }
 
-    return bytes_sent;
+    if (!rx->start_frame_received) {
+        uint8_t header_size;
+
+        if (frame_type == CTP_START_FRAME && len >= CTP_START_FRAME_HEADER_SIZE) {
+            header_size = CTP_START_FRAME_HEADER_SIZE;
+            rx->expected_total_length = (data[1] << 8) | data[2];
+        }
+        else if (frame_type == CTP_EXT_START_FRAME && len >= CTP_EXT_START_FRAME_HEADER_SIZE) {
+            if (data[1] & ~CTP_EXT_FLAGS_SUPPORTED) {
+                return ctp_rx_fail(rx, CTP_INVALID_FRAME_TYPE);
+            }
+
+            header_size = CTP_EXT_START_FRAME_HEADER_SIZE;
+            start_data_size = rx->fd ? CTP_FD_EXT_START_DATA_SIZE : CTP_EXT_START_DATA_SIZE;
+            rx->flags = data[1];
+            rx->trailer_length = (rx->flags & CTP_EXT_FLAG_CRC32) ? CTP_CRC_LENGTH : 0;
+            rx->expected_total_length = ((uint32_t)data[2] << 24) | ((uint32_t)data[3] << 16) |
+                                        ((uint32_t)data[4] << 8) | data[5];
+        }
+        else {
+            return CTP_RX_IN_PROGRESS;
+        }
+
+        if (rx->expected_total_length > rx->buffer_size) {
+            ctp_rx_flow_control(rx, CTP_FC_OVERFLOW);
+            return ctp_rx_overflow(rx);
+        }
+
+        uint32_t sequence_length = rx->expected_total_length + rx->trailer_length;
+        uint8_t start_frame_length = (sequence_length > start_data_size) ? start_data_size : sequence_length;
+
+        if (len < header_size + start_frame_length) {
+            return ctp_rx_fail(rx, CTP_INVALID_FRAME_LENGTH);
+        }
+
+        if (!ctp_rx_store(rx, 0, &data[header_size], start_frame_length, false)) {
+            return ctp_rx_fail(rx, CTP_SINK_ABORTED);
+        }
+        rx->start_length = start_frame_length;
+        rx->start_us = ctp_now_us(rx->ctx);
+        rx->id = id;
+        rx->start_frame_received = true;
+        ctp_rx_stamp(rx, timestamp_us);
+
+        if (sequence_length == start_frame_length) {
+            return ctp_rx_complete(rx);
+        }
+
+        // CONSECUTIVE frames carry everything but the last 1..end_data_size bytes
+        uint32_t middle = sequence_length - start_frame_length;
+        rx->consecutive_frames = (middle > end_data_size) ? (middle - end_data_size + con_data_size - 1) / con_data_size : 0;
+
+        ctp_rx_arm(rx);
+        ctp_rx_flow_control(rx, CTP_FC_CONTINUE);
+        return CTP_RX_IN_PROGRESS;
+    }
+
+    if (id != rx->id) {
+        return CTP_RX_IN_PROGRESS;
+    }
+
+    ctp_rx_arm(rx);
+    ctp_rx_stamp(rx, timestamp_us);
+
+    uint32_t index;
+    uint32_t sequence_length = rx->expected_total_length + rx->trailer_length;
+    uint32_t end_offset = rx->start_length + rx->consecutive_frames * con_data_size;
+    uint8_t sequence = (len > 1) ? data[1] : 0;
+    uint8_t con_header_size = CTP_CONSECUTIVE_FRAME_HEADER_SIZE;
+    uint8_t end_header_size = CTP_END_FRAME_HEADER_SIZE;
+
+    // Compact frames only have to be in order, the one after the last full
+    // frame is the END frame
+    if (rx->flags & CTP_EXT_FLAG_COMPACT) {
+        if ((frame_type & CTP_COMPACT_PCI_MASK) != CTP_COMPACT_PCI) {
+            return CTP_RX_IN_PROGRESS;
+        }
+        if ((frame_type & CTP_COMPACT_SEQUENCE_MASK) != (rx->next_frame & CTP_COMPACT_SEQUENCE_MASK)) {
+            return ctp_rx_fail(rx, CTP_INVALID_SEQUENCE_NUMBER);
+        }
+
+        frame_type = (rx->next_frame < rx->consecutive_frames) ? CTP_CONSECUTIVE_FRAME : CTP_END_FRAME;
+        sequence = (uint8_t)rx->next_frame;
+        con_header_size = CTP_COMPACT_HEADER_SIZE;
+        end_header_size = CTP_COMPACT_HEADER_SIZE;
+    }
+
+    switch (frame_type) {
+        case CTP_CONSECUTIVE_FRAME:
+            if (len < con_header_size + con_data_size) {
+                return ctp_rx_fail(rx, CTP_INVALID_FRAME_LENGTH);
+            }
+
+            // Sequence numbers up to half the window ahead are new frames,
+            // the ones behind are retransmissions or duplicates
+            uint8_t delta = (uint8_t)(sequence - (uint8_t)rx->next_frame);
+
+            if (delta != 0 && !ctp_rx_retransmit(rx)) {
+                return ctp_rx_fail(rx, CTP_INVALID_SEQUENCE_NUMBER);
+            }
+
+            if (delta < CTP_RETRANSMIT_WINDOW / 2) {
+                index = rx->next_frame + delta;
+            }
+            else {
+                index = rx->next_frame - (CTP_RETRANSMIT_WINDOW - delta);
+
+                if (index >= rx->next_frame || !ctp_rx_recover(rx, index)) {
+                    return CTP_RX_IN_PROGRESS;  // Duplicate, already have it
+                }
+            }
+
+            // A full CONSECUTIVE frame must always leave room for the END frame
+            if (index >= rx->consecutive_frames) {
+                return ctp_rx_overflow(rx);
+            }
+
+            bool late = index < rx->next_frame;
+
+            if (!late) {
+                for (uint32_t lost = rx->next_frame; lost < index; lost++) {
+                    if (!ctp_rx_nack(rx, lost)) {
+                        return ctp_rx_fail(rx, CTP_INVALID_SEQUENCE_NUMBER);
+                    }
+                }
+                ctp_rx_count_block(rx, index + 1 - rx->next_frame);
+                rx->next_frame = index + 1;
+            }
+
+            if (!ctp_rx_store(rx, rx->start_length + index * con_data_size, &data[con_header_size],
+                              con_data_size, late)) {
+                return ctp_rx_fail(rx, CTP_SINK_ABORTED);
+            }
+
+            if (rx->end_received && rx->missing_count == 0) {
+                return ctp_rx_complete(rx);
+            }
+            return CTP_RX_IN_PROGRESS;
+
+        case CTP_END_FRAME:
+            if (rx->end_received) {
+                return CTP_RX_IN_PROGRESS;
+            }
+            if (len < end_header_size + sequence_length - end_offset) {
+                return ctp_rx_overflow(rx);
+            }
+
+            // The frames right before END went missing
+            if (rx->next_frame < rx->consecutive_frames) {
+                if (!ctp_rx_retransmit(rx)) {
+                    return ctp_rx_fail(rx, CTP_INVALID_SEQUENCE_NUMBER);
+                }
+                for (; rx->next_frame < rx->consecutive_frames; rx->next_frame++) {
+                    if (!ctp_rx_nack(rx, rx->next_frame)) {
+                        return ctp_rx_fail(rx, CTP_INVALID_SEQUENCE_NUMBER);
+                    }
+                }
+            }
+
+            if (!ctp_rx_store(rx, end_offset, &data[end_header_size], sequence_length - end_offset, false)) {
+                return ctp_rx_fail(rx, CTP_SINK_ABORTED);
+            }
+            rx->end_received = true;
+
+            if (rx->missing_count == 0) {
+                return ctp_rx_complete(rx);  // Successfully received the full frame
+            }
+            return CTP_RX_IN_PROGRESS;
+
+        default:
+            // In case of unexpected frame type, keep trying
+            return CTP_RX_IN_PROGRESS;
+    }
+}
+
+#define CTP_RX_TABLE_INDEX_MASK (CTP_RX_TABLE_INDEX_SIZE - 1)
+
+void ctp_rx_table_init(CTP_RxTable *table, CTP_Context *ctx, bool fd) {
+    table->ctx = ctx;
+    table->fd = fd;
+
+    for (uint32_t i = 0; i < CTP_RX_TABLE_INDEX_SIZE; i++) {
+        table->index[i] = -1;
+    }
+
+    // Hand out low slots first
+    table->free_count = CTP_RX_TABLE_SIZE;
+    for (uint32_t i = 0; i < CTP_RX_TABLE_SIZE; i++) {
+        table->free_slots[i] = CTP_RX_TABLE_SIZE - 1 - i;
+        ctp_rx_init(&table->slots[i].rx, ctx, table->slots[i].buffer, CTP_RX_TABLE_BUFFER_SIZE, fd);
+    }
+}
+
+static inline uint64_t ctp_rx_table_key(uint32_t channel, uint32_t id) {
+    return ((uint64_t)channel << 32) | id;
+}
+
+static inline uint32_t ctp_rx_table_hash(uint64_t key) {
+    // Fibonacci hashing spreads the sequential IDs typically found on a bus. The
+    // high bits of the product depend on every bit of the ID, so IDs equal in
+    // their low bits, e.g. J1939 IDs of one source address, don't collide.
+    uint32_t mixed = (uint32_t)key ^ ((uint32_t)(key >> 32) * 0x9E3779B9u);
+
+    return (mixed * 2654435761u) >> (32 - CTP_RX_TABLE_INDEX_BITS);
+}
+
+// Returns the index position holding key, or -1
+static int32_t ctp_rx_table_lookup(const CTP_RxTable *table, uint64_t key) {
+    uint32_t pos = ctp_rx_table_hash(key);
+
+    while (table->index[pos] >= 0) {
+        if (table->keys[pos] == key) {
+            return pos;
+        }
+        pos = (pos + 1) & CTP_RX_TABLE_INDEX_MASK;
+    }
+
+    return -1;
+}
+
+// Remove the entry at pos, shifting back later entries of the probe chain so
+// lookups never need tombstones
+static void ctp_rx_table_delete_at(CTP_RxTable *table, uint32_t pos) {
+    table->free_slots[table->free_count++] = table->index[pos];
+    table->index[pos] = -1;
+
+    uint32_t next = (pos + 1) & CTP_RX_TABLE_INDEX_MASK;
+
+    while (table->index[next] >= 0) {
+        uint32_t home = ctp_rx_table_hash(table->keys[next]);
+
+        // Move the entry if its home position doesn't lie in (pos, next]
+        if (((next - home) & CTP_RX_TABLE_INDEX_MASK) >= ((next - pos) & CTP_RX_TABLE_INDEX_MASK)) {
+            table->keys[pos] = table->keys[next];
+            table->index[pos] = table->index[next];
+            table->index[next] = -1;
+            pos = next;
+        }
+        next = (next + 1) & CTP_RX_TABLE_INDEX_MASK;
+    }
+}
+
+// Free a slot whose session has already completed or failed. Only runs when
+// the table is full, so the linear scan stays off the hot path.
+static bool ctp_rx_table_reclaim(CTP_RxTable *table) {
+    for (uint32_t pos = 0; pos < CTP_RX_TABLE_INDEX_SIZE; pos++) {
+        if (table->index[pos] >= 0 && table->slots[table->index[pos]].rx.done) {
+            ctp_rx_table_delete_at(table, pos);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static CTP_Receiver *ctp_rx_table_insert(CTP_RxTable *table, uint64_t key, CTP_Context *ctx) {
+    if (table->free_count == 0 && !ctp_rx_table_reclaim(table)) {
+        return NULL;
+    }
+
+    uint32_t pos = ctp_rx_table_hash(key);
+
+    while (table->index[pos] >= 0) {
+        pos = (pos + 1) & CTP_RX_TABLE_INDEX_MASK;
+    }
+
+    uint16_t slot = table->free_slots[--table->free_count];
+    table->keys[pos] = key;
+    table->index[pos] = slot;
+
+    CTP_Receiver *rx = &table->slots[slot].rx;
+    rx->ctx = ctx;
+    ctp_rx_reset(rx);
+
+    return rx;
+}
+
+static CTP_Receiver *ctp_rx_table_get(CTP_RxTable *table, uint64_t key) {
+    int32_t pos = ctp_rx_table_lookup(table, key);
+
+    if (pos < 0) {
+        return NULL;
+    }
+
+    return &table->slots[table->index[pos]].rx;
+}
+
+CTP_Receiver *ctp_rx_table_find(CTP_RxTable *table, uint32_t id) {
+    return ctp_rx_table_get(table, ctp_rx_table_key(0, id));
+}
+
+void ctp_rx_table_remove(CTP_RxTable *table, uint32_t id) {
+    int32_t pos = ctp_rx_table_lookup(table, ctp_rx_table_key(0, id));
+
+    if (pos >= 0) {
+        ctp_rx_table_delete_at(table, pos);
+    }
+}
+
+// Abort and remove every session whose next frame is overdue, so stalled
+// senders don't hold on to slots. Returns the number of sessions removed.
+uint32_t ctp_rx_table_expire(CTP_RxTable *table) {
+    uint32_t expired = 0;
+    uint32_t pos = 0;
+
+    // Past the end, finish the run that wraps around to the start. Removals
+    // shift its entries back across the wraparound, they get looked at there.
+    while (pos < CTP_RX_TABLE_INDEX_SIZE || table->index[pos & CTP_RX_TABLE_INDEX_MASK] >= 0) {
+        uint32_t i = pos & CTP_RX_TABLE_INDEX_MASK;
+
+        if (table->index[i] >= 0 && ctp_rx_expire(&table->slots[table->index[i]].rx)) {
+            // Removing shifts a later entry into i, look at it again
+            ctp_rx_table_delete_at(table, i);
+            expired++;
+            continue;
+        }
+        pos++;
+    }
+
+    return expired;
+}
+
+// Feed one CAN frame to the session of its CAN ID. A START frame opens a
+// session for an unknown ID, other frames of unknown IDs are ignored. The
+// session is returned through *session, the data of a completed session
+// stays valid until the next call for the same ID or until the table runs
+// out of free slots. When no slot is free CTP_RX_ERROR is returned with a
+// NULL session.
+CTP_RxStatus ctp_rx_table_feed(CTP_RxTable *table, uint32_t id, const uint8_t *data, uint8_t len, CTP_Receiver **session) {
+    return ctp_rx_table_feed_channel(table, table->ctx, 0, id, data, len, session);
+}
+
+static CTP_RxStatus ctp_rx_table_feed_at(CTP_RxTable *table, CTP_Context *ctx, uint32_t channel, uint32_t id,
+                                         const uint8_t *data, uint8_t len, uint64_t timestamp_us, CTP_Receiver **session) {
+    uint64_t key = ctp_rx_table_key(channel, id);
+    CTP_Receiver *rx = ctp_rx_table_get(table, key);
+
+    *session = NULL;
+
+    if (rx == NULL) {
+        if (len == 0 || (data[0] != CTP_START_FRAME && data[0] != CTP_EXT_START_FRAME)) {
+            return CTP_RX_IN_PROGRESS;
+        }
+
+        rx = ctp_rx_table_insert(table, key, ctx);
+
+        if (rx == NULL) {
+            if (ctx != NULL) {
+                ctp_stat_add(&ctx->stats.aborted, 1);
+            }
+            return CTP_RX_ERROR;  // Error: no free session
+        }
+    }
+
+    *session = rx;
+
+    return ctp_rx_feed_at(rx, id, data, len, timestamp_us);
+}
+
+// Same as ctp_rx_table_feed() for a table shared by several channels. Sessions
+// are kept apart by channel number, a new session answers flow control on ctx.
+CTP_RxStatus ctp_rx_table_feed_channel(CTP_RxTable *table, CTP_Context *ctx, uint32_t channel, uint32_t id,
+                                       const uint8_t *data, uint8_t len, CTP_Receiver **session) {
+    return ctp_rx_table_feed_at(table, ctx, channel, id, data, len, 0, session);
+}
+
+// Same as ctp_rx_table_feed_channel() for a frame read from the driver, the
+// session's timing gets its receive timestamp
+CTP_RxStatus ctp_rx_table_feed_frame(CTP_RxTable *table, CTP_Context *ctx, uint32_t channel, const CTP_CanFrame *frame,
+                                     CTP_Receiver **session) {
+    return ctp_rx_table_feed_at(table, ctx, channel, frame->id, frame->data, frame->len, frame->timestamp_us, session);
+}
+
+// Feed frames to rx until its sequence completes, fails or runs out of time.
+// Returns the sequence length or -1, for receivers set up by the caller.
+int32_t ctp_receive_rx(CTP_Context *ctx, CTP_Receiver *rx) {
+    CTP_CanFrame frame;
+    uint64_t deadline = 0;
+
+    if (ctx->timeouts.call_us != 0 && ctx->driver->now_us != NULL) {
+        deadline = ctp_now_us(ctx) + ctx->timeouts.call_us;
+    }
+
+    while (1) {
+        // Traffic of other IDs must not keep a stalled sequence alive, check every time
+        if (ctp_rx_expire(rx)) {
+            return -1;
+        }
+        if (deadline != 0 && ctp_now_us(ctx) >= deadline) {
+            ctp_rx_fail(rx, CTP_MESSAGE_TIMEOUT);
+            return -1;
+        }
+
+        if (!ctp_read_frame(ctx, &frame)) {
+            continue;  // Keep trying until we get a message
+        }
+
+        switch (ctp_rx_feed_frame(rx, &frame)) {
+            case CTP_RX_COMPLETE:
+                return rx->received_length;
+            case CTP_RX_ERROR:
+                return -1;
+            default:
+                break;
+        }
+    }
+}
+
+// Receive one sequence. A plain START frame's payload_len field is 16 bits, so
+// those sequences carry at most 0xFFFF bytes, for larger data size use
+// ctp_receive or extended sequences. Gives up with -1 when ctx->timeouts expire.
+int32_t ctp_receive_seq(CTP_Context *ctx, uint8_t* buffer, uint32_t buffer_size, bool fd) {
+    CTP_Receiver rx;
+
+    ctp_rx_init(&rx, ctx, buffer, buffer_size, fd);
+
+    return ctp_receive_rx(ctx, &rx);
+}
+
+// Same as ctp_receive_seq(), with the receive times of the sequence's frames
+// copied to timing, see CTP_RxTiming
+int32_t ctp_receive_seq_timed(CTP_Context *ctx, uint8_t *buffer, uint32_t buffer_size, bool fd, CTP_RxTiming *timing) {
+    CTP_Receiver rx;
+
+    ctp_rx_init(&rx, ctx, buffer, buffer_size, fd);
+
+    int32_t length = ctp_receive_rx(ctx, &rx);
+    *timing = rx.timing;
+
+    return length;
+}
+
+// Receive one sequence into sink, returns its length or -1
+int32_t ctp_receive_sink(CTP_Context *ctx, CTP_Sink sink, void *user, bool fd) {
+    CTP_Receiver rx;
+
+    ctp_rx_init_sink(&rx, ctx, sink, user, fd);
+
+    return ctp_receive_rx(ctx, &rx);
+}
+
+// Receive length bytes, and store it in the buffer.
+int32_t ctp_receive(CTP_Context *ctx, uint8_t *buffer, uint32_t length, bool fd) {
+    uint32_t bytes_received = 0;
+    
+    while (bytes_received < length) {
+        int32_t seq_len = ctp_receive_seq(ctx, buffer + bytes_received, length - bytes_received, fd);
+
+        if (seq_len < 0) {
+            return -1;
+        }
+
+        bytes_received += seq_len;
+    }
+
+    return bytes_received;
+}
+
+void ctp_encoder_init(CTP_Encoder *enc, const uint8_t *data, uint16_t length, bool fd) {
+    enc->data = data;
+    enc->length = length;
+    enc->offset = 0;
+    enc->consecutive_count = 0;
+    enc->trailer_length = 0;
+    enc->flags = 0;
+    enc->extended = false;
+    enc->started = false;
+    enc->fd = fd;
+    enc->padding.value = CTP_PADDING_BYTE;
+    enc->padding.min_length = 0;
+}
+
+// Start the sequence with an extended START frame, which carries a 32 bit
+// length. With CTP_EXT_FLAG_CRC32 a CRC-32 of the data is appended, with
+// CTP_EXT_FLAG_COMPACT the frames after the START frame are compact ones.
+void ctp_encoder_init_extended(CTP_Encoder *enc, const uint8_t *data, uint32_t length, bool fd, uint8_t flags) {
+    ctp_encoder_init(enc, data, 0, fd);
+    enc->length = length;
+    enc->flags = flags;
+    enc->extended = true;
+
+    if (flags & CTP_EXT_FLAG_CRC32) {
+        uint32_t crc = ctp_crc32(0, data, length);
+
+        enc->trailer[0] = (uint8_t)(crc >> 24);
+        enc->trailer[1] = (uint8_t)(crc >> 16);
+        enc->trailer[2] = (uint8_t)(crc >> 8);
+        enc->trailer[3] = (uint8_t)crc;
+        enc->trailer_length = CTP_CRC_LENGTH;
+        enc->length += CTP_CRC_LENGTH;
+    }
+}
+
+// Copy n bytes of the sequence at offset, the trailer follows the caller's data
+static inline void ctp_encoder_copy(const CTP_Encoder *enc, uint8_t *out, uint32_t offset, uint32_t n) {
+    uint32_t data_length = enc->length - enc->trailer_length;
+    uint32_t head = 0;
+
+    if (offset + n <= data_length) {
+        memcpy(out, enc->data + offset, n);
+        return;
+    }
+
+    if (offset < data_length) {
+        head = data_length - offset;
+        memcpy(out, enc->data + offset, head);
+    }
+    memcpy(out + head, &enc->trailer[offset + head - data_length], n - head);
+}
+
+static inline uint8_t ctp_encoder_frame(CTP_Encoder *enc, uint8_t *out);
+
+// Encode the next frame of the sequence into out, which must hold
+// CAN_MAX_DATA_LENGTH bytes. Returns the frame length, padded to the smallest
+// legal one, 0 once the whole sequence has been encoded.
+uint8_t ctp_encoder_next(CTP_Encoder *enc, uint8_t *out) {
+    uint8_t len = ctp_encoder_frame(enc, out);
+
+    return (len > 0) ? ctp_pad_frame(&enc->padding, out, len) : 0;
+}
+
+static inline uint8_t ctp_encoder_frame(CTP_Encoder *enc, uint8_t *out) {
+    uint8_t start_data_size;
+    uint8_t end_data_size;
+    uint8_t con_data_size;
+
+    if (enc->fd) {
+        end_data_size = CTP_FD_END_DATA_LENGTH;
+        con_data_size = CTP_FD_CONSECUTIVE_DATA_LENGTH;
+    }
+    else {
+        end_data_size = CTP_END_DATA_LENGTH;
+        con_data_size = CTP_CONSECUTIVE_DATA_LENGTH;
+    }
+
+    if (!enc->started) {
+        uint8_t header_size;
+
+        if (enc->extended) {
+            uint32_t data_length = enc->length - enc->trailer_length;
+
+            header_size = CTP_EXT_START_FRAME_HEADER_SIZE;
+            start_data_size = enc->fd ? CTP_FD_EXT_START_DATA_SIZE : CTP_EXT_START_DATA_SIZE;
+            out[0] = CTP_EXT_START_FRAME;
+            out[1] = enc->flags;
+            out[2] = (uint8_t)(data_length >> 24);
+            out[3] = (uint8_t)(data_length >> 16);
+            out[4] = (uint8_t)(data_length >> 8);
+            out[5] = (uint8_t)(data_length & 0xFF);
+        }
+        else {
+            header_size = CTP_START_FRAME_HEADER_SIZE;
+            start_data_size = enc->fd ? CTP_FD_START_DATA_SIZE : CTP_START_DATA_SIZE;
+            out[0] = CTP_START_FRAME;
+            out[1] = (uint8_t)(enc->length >> 8);
+            out[2] = (uint8_t)(enc->length & 0xFF);
+        }
+
+        uint8_t start_frame_length = (enc->length > start_data_size) ? start_data_size : enc->length;
+        ctp_encoder_copy(enc, &out[header_size], 0, start_frame_length);
+
+        enc->offset = start_frame_length;
+        enc->started = true;
+        return start_frame_length + header_size;
+    }
+
+    uint32_t bytes_left = enc->length - enc->offset;
+
+    if (bytes_left == 0) {
+        return 0;
+    }
+
+    // Compact frames are full up to the last one, which ends the sequence
+    if (enc->extended && (enc->flags & CTP_EXT_FLAG_COMPACT)) {
+        uint8_t compact_size = enc->fd ? CTP_FD_COMPACT_DATA_LENGTH : CTP_COMPACT_DATA_LENGTH;
+        uint8_t n = (bytes_left > compact_size) ? compact_size : (uint8_t)bytes_left;
+
+        out[0] = CTP_COMPACT_PCI | (enc->consecutive_count++ & CTP_COMPACT_SEQUENCE_MASK);
+        ctp_encoder_copy(enc, &out[CTP_COMPACT_HEADER_SIZE], enc->offset, n);
+        enc->offset += n;
+        return n + CTP_COMPACT_HEADER_SIZE;
+    }
+
+    if (bytes_left <= end_data_size) {
+        out[0] = CTP_END_FRAME;
+        ctp_encoder_copy(enc, &out[CTP_END_FRAME_HEADER_SIZE], enc->offset, bytes_left);
+        enc->offset += bytes_left;
+        return bytes_left + CTP_END_FRAME_HEADER_SIZE;
+    }
+
+    out[0] = CTP_CONSECUTIVE_FRAME;
+    out[1] = (uint8_t)enc->consecutive_count++;
+    ctp_encoder_copy(enc, &out[CTP_CONSECUTIVE_FRAME_HEADER_SIZE], enc->offset, con_data_size);
+    enc->offset += con_data_size;
+    return con_data_size + CTP_CONSECUTIVE_FRAME_HEADER_SIZE;
+}
+
+// Number of frames needed to send length bytes as one sequence
+uint32_t ctp_sequence_frame_count(uint16_t length, bool fd) {
+    uint8_t start_data_size = fd ? CTP_FD_START_DATA_SIZE : CTP_START_DATA_SIZE;
+    uint8_t end_data_size = fd ? CTP_FD_END_DATA_LENGTH : CTP_END_DATA_LENGTH;
+    uint8_t con_data_size = fd ? CTP_FD_CONSECUTIVE_DATA_LENGTH : CTP_CONSECUTIVE_DATA_LENGTH;
+
+    if (length <= start_data_size) {
+        return 1;
+    }
+
+    // CONSECUTIVE frames carry everything but the last 1..end_data_size bytes
+    uint32_t middle = length - start_data_size;
+    uint32_t con_frames = (middle > end_data_size) ? (middle - end_data_size + con_data_size - 1) / con_data_size : 0;
+
+    return 2 + con_frames;
+}
+
+// Encode a whole sequence into a contiguous frame array, returns the number of
+// frames written. Stops early when max_frames is reached, size the array with
+// ctp_sequence_frame_count(). Frames are padded to the smallest legal length
+// only, ctp_send_batch() pads them as the context asks for.
+uint32_t ctp_encode_sequence(uint32_t id, const uint8_t *data, uint16_t length, bool fd, CTP_CanFrame *frames, uint32_t max_frames) {
+    CTP_Encoder enc;
+    uint32_t count = 0;
+
+    ctp_encoder_init(&enc, data, length, fd);
+
+    while (count < max_frames && (frames[count].len = ctp_encoder_next(&enc, frames[count].data)) > 0) {
+        frames[count].id = id;
+        count++;
+    }
+
+    return count;
+}
+
+// Hand a burst of frames to the driver in as few calls as it allows, falls
+// back to one send per frame. Unless the encoder padded them with ctx->padding
+// already, frames shorter than it asks for go out padded, the caller's frames
+// stay as they are. Returns the number of frames sent.
+static uint32_t ctp_send_burst(CTP_Context *ctx, const CTP_CanFrame *frames, uint32_t count, bool padded_already) {
+    const CTP_Driver *driver = ctx->driver;
+    uint32_t sent = 0;
+
+    if (driver->send_batch != NULL) {
+        CTP_CanFrame padded[CTP_TX_BATCH_SIZE];
+
+        while (sent < count) {
+            const CTP_CanFrame *burst = &frames[sent];
+            uint32_t n = count - sent;
+            uint32_t i = padded_already ? n : 0;
+
+            while (i < n && ctp_padded_length(&ctx->padding, burst[i].len) == burst[i].len) {
+                i++;
+            }
+
+            if (i < n) {
+                n = (n > CTP_TX_BATCH_SIZE) ? CTP_TX_BATCH_SIZE : n;
+                for (i = 0; i < n; i++) {
+                    padded[i] = burst[i];
+                    padded[i].len = ctp_pad_frame(&ctx->padding, padded[i].data, padded[i].len);
+                }
+                burst = padded;
+            }
+
+            n = driver->send_batch(ctx->handle, burst, n);
+
+            if (n == 0) {
+                break;
+            }
+            CTP_StatTally tally = {0};
+
+            for (i = 0; i < n; i++) {
+                ctp_stat_tally(&tally, burst[i].data, burst[i].len);
+            }
+            ctp_stat_flush(ctx->stats.frames_tx, &ctx->stats.bytes_tx, &tally);
+            sent += n;
+        }
+
+        return sent;
+    }
+
+    for (; sent < count; sent++) {
+        const CTP_CanFrame *frame = &frames[sent];
+        bool ok = padded_already ? ctp_driver_send_padded(ctx, frame->id, frame->data, frame->len)
+                                 : ctp_driver_send(ctx, frame->id, frame->data, frame->len);
+
+        if (!ok) {
+            break;
+        }
+    }
+
+    return sent;
+}
+
+uint32_t ctp_send_batch(CTP_Context *ctx, const CTP_CanFrame *frames, uint32_t count) {
+    return ctp_send_burst(ctx, frames, count, false);
+}
+
+// Decode an ISO-TP separation time into microseconds
+uint32_t ctp_st_min_us(uint8_t st_min) {
+    if (st_min <= 0x7F) {
+        return st_min * 1000;           // 0-127 ms
+    }
+    if (st_min >= 0xF1 && st_min <= 0xF9) {
+        return (st_min - 0xF0) * 100;   // 100-900 us
+    }
+    return 0x7F * 1000;                 // Reserved values mean the longest time
+}
+
+// Wait out a separation time with the driver's sleep, or by spinning on its clock
+static void ctp_delay_us(CTP_Context *ctx, uint32_t us) {
+    const CTP_Driver *driver = ctx->driver;
+
+    if (us == 0) {
+        return;
+    }
+
+    if (driver->sleep_us != NULL) {
+        driver->sleep_us(ctx->handle, us);
+    }
+    else if (driver->now_us != NULL) {
+        uint64_t deadline = driver->now_us(ctx->handle) + us;
+        while (driver->now_us(ctx->handle) < deadline) {
+        }
+    }
+}
+
+// Sender side state of a sequence with flow control or retransmission enabled
+typedef struct {
+    CTP_Context *ctx;
+    CTP_Encoder enc;
+    uint32_t id;
+    uint32_t credits;                   // Frames left in the granted block
+    uint32_t st_min_us;
+    uint64_t deadline;
+    bool complete;                      // The receiver confirmed the sequence
+    bool aborted;
+} CTP_Sender;
+
+static void ctp_sender_restart_timer(CTP_Sender *tx) {
+    const CTP_Driver *driver = tx->ctx->driver;
+
+    if (driver->now_us != NULL && tx->ctx->flow_control.timeout_us != 0) {
+        tx->deadline = driver->now_us(tx->ctx->handle) + tx->ctx->flow_control.timeout_us;
+    }
+}
+
+static bool ctp_sender_timed_out(CTP_Sender *tx) {
+    const CTP_Driver *driver = tx->ctx->driver;
+
+    return driver->now_us != NULL && tx->ctx->flow_control.timeout_us != 0 &&
+           driver->now_us(tx->ctx->handle) >= tx->deadline;
+}
+
+// Resend a NACKed CONSECUTIVE frame. The sequence number maps to the latest
+// frame sent with it and the frame is encoded again from the caller's data,
+// which doubles as the retransmit buffer.
+static void ctp_sender_resend(CTP_Sender *tx, uint8_t sequence) {
+    const CTP_Encoder *enc = &tx->enc;
+    uint8_t start_data_size;
+    uint8_t con_data_size = enc->fd ? CTP_FD_CONSECUTIVE_DATA_LENGTH : CTP_CONSECUTIVE_DATA_LENGTH;
+    uint8_t can_data[CAN_MAX_DATA_LENGTH];
+
+    if (enc->consecutive_count == 0) {
+        return;
+    }
+
+    if (enc->extended) {
+        start_data_size = enc->fd ? CTP_FD_EXT_START_DATA_SIZE : CTP_EXT_START_DATA_SIZE;
+    }
+    else {
+        start_data_size = enc->fd ? CTP_FD_START_DATA_SIZE : CTP_START_DATA_SIZE;
+    }
+
+    uint32_t last = enc->consecutive_count - 1;
+    uint32_t index = last - (uint8_t)((uint8_t)last - sequence);
+
+    if (index > last) {
+        return;  // Never sent
+    }
+
+    can_data[0] = CTP_CONSECUTIVE_FRAME;
+    can_data[1] = sequence;
+    ctp_encoder_copy(enc, &can_data[CTP_CONSECUTIVE_FRAME_HEADER_SIZE], start_data_size + index * con_data_size, con_data_size);
+    ctp_driver_send(tx->ctx, tx->id, can_data, con_data_size + CTP_CONSECUTIVE_FRAME_HEADER_SIZE);
+}
+
+// Handle a frame from the receiver. Anything but flow control frames and NACKs
+// on flow_control.rx_id is dropped.
+static void ctp_sender_control(CTP_Sender *tx, const CTP_CanFrame *frame) {
+    const CTP_FlowControl *fc = &tx->ctx->flow_control;
+
+    if (frame->id != fc->rx_id || frame->len == 0) {
+        return;
+    }
+
+    if (frame->data[0] == CTP_ERROR_FRAME) {
+        if (fc->retransmit && frame->len >= CTP_NACK_FRAME_LENGTH && frame->data[1] == CTP_INVALID_SEQUENCE_NUMBER) {
+            ctp_sender_resend(tx, frame->data[2]);
+            ctp_sender_restart_timer(tx);
+        }
+        return;
+    }
+
+    if (frame->len < CTP_FLOW_CONTROL_FRAME_LENGTH || frame->data[0] != CTP_FLOW_CONTROL_FRAME) {
+        return;
+    }
+
+    switch (frame->data[1]) {
+        case CTP_FC_CONTINUE:
+            if (fc->enabled) {
+                tx->credits = frame->data[2] ? frame->data[2] : UINT32_MAX;
+                tx->st_min_us = ctp_st_min_us(frame->data[3]);
+            }
+            break;
+
+        case CTP_FC_WAIT:
+            ctp_sender_restart_timer(tx);
+            break;
+
+        case CTP_FC_COMPLETE:
+            tx->complete = true;
+            break;
+
+        default:
+            tx->aborted = true;
+            ctp_stat_add(&tx->ctx->stats.aborted, 1);
+            break;
+    }
+}
+
+// Handle whatever the receiver sent so far without blocking
+static void ctp_sender_poll(CTP_Sender *tx) {
+    CTP_CanFrame frame;
+
+    while (!tx->aborted && ctp_read_frame(tx->ctx, &frame)) {
+        ctp_sender_control(tx, &frame);
+    }
+}
+
+// Wait for the receiver to grant the next block or, with for_complete, to
+// confirm the sequence. Returns false when the receiver aborts or doesn't
+// answer in time.
+static bool ctp_sender_wait(CTP_Sender *tx, bool for_complete) {
+    CTP_CanFrame frame;
+
+    ctp_sender_restart_timer(tx);
+
+    while (!tx->aborted) {
+        if (for_complete ? tx->complete : tx->credits > 0) {
+            return true;
+        }
+
+        if (ctp_sender_timed_out(tx)) {
+            ctp_stat_add(&tx->ctx->stats.timeouts, 1);
+            return false;
+        }
+
+        if (ctp_read_frame(tx->ctx, &frame)) {
+            ctp_sender_control(tx, &frame);
+        }
+    }
+
+    return false;
+}
+
+// Encode and send up to max_frames frames of the sequence, st_min_us apart.
+// Returns the number of frames the driver took. When it takes fewer than were
+// encoded *failed is set, the encoder has moved past frames that never went out.
+static uint32_t ctp_send_frames(CTP_Context *ctx, CTP_Encoder *enc, uint32_t id, uint32_t max_frames, uint32_t st_min_us,
+                                bool *failed) {
+    uint32_t sent = 0;
+
+    *failed = false;
+
+    if (ctx->driver->send_batch != NULL && st_min_us == 0) {
+        CTP_CanFrame frames[CTP_TX_BATCH_SIZE];
+        uint32_t count;
+
+        do {
+            for (count = 0; count < CTP_TX_BATCH_SIZE && sent + count < max_frames; count++) {
+                frames[count].len = ctp_encoder_next(enc, frames[count].data);
+
+                if (frames[count].len == 0) {
+                    break;
+                }
+                frames[count].id = id;
+            }
+
+            uint32_t n = ctp_send_burst(ctx, frames, count, true);
+            sent += n;
+
+            if (n < count) {
+                *failed = true;
+                break;
+            }
+        } while (count == CTP_TX_BATCH_SIZE);
+
+        return sent;
+    }
+
+    uint8_t can_data[CAN_MAX_DATA_LENGTH];
+    uint8_t frame_length;
+    CTP_StatTally tally = {0};
+
+    // Frames are encoded in place, the payload is copied exactly once
+    while (sent < max_frames && (frame_length = ctp_encoder_next(enc, can_data)) > 0) {
+        if (sent > 0) {
+            ctp_delay_us(ctx, st_min_us);
+        }
+        if (!ctx->driver->send(ctx->handle, id, can_data, frame_length)) {
+            *failed = true;
+            break;
+        }
+        ctp_stat_tally(&tally, can_data, frame_length);
+        sent++;
+    }
+    ctp_stat_flush(ctx->stats.frames_tx, &ctx->stats.bytes_tx, &tally);
+
+    return sent;
 }
 
-uint32_t ctp_send(uint32_t id, uint8_t *data, uint32_t length, bool fd) {
+// Send the sequence set up in tx->enc. With flow control enabled the sender
+// waits for the receiver's credits after the START frame and after every block.
+// With retransmission enabled it resends NACKed frames between bursts and waits
+// for the receiver to confirm the sequence. Returns 0 if the receiver aborts or
+// stops answering, or the driver doesn't take a frame.
+static uint32_t ctp_send_encoded(CTP_Context *ctx, uint32_t id, CTP_Sender *tx) {
+    const CTP_FlowControl *fc = &ctx->flow_control;
+    bool failed;
+
+    tx->enc.padding = ctx->padding;
+
+    if (!fc->enabled && !fc->retransmit) {
+        ctp_send_frames(ctx, &tx->enc, id, UINT32_MAX, 0, &failed);
+        return failed ? 0 : tx->enc.offset;
+    }
+
+    tx->ctx = ctx;
+    tx->id = id;
+    tx->credits = fc->enabled ? 0 : UINT32_MAX;
+    tx->st_min_us = 0;
+    tx->deadline = 0;
+    tx->complete = false;
+    tx->aborted = false;
+
+    if (ctp_send_frames(ctx, &tx->enc, id, 1, 0, &failed) == 0) {
+        return 0;
+    }
+
+    bool in_block = false;
+
+    while (tx->enc.offset < tx->enc.length) {
+        if (tx->credits == 0) {
+            if (!ctp_sender_wait(tx, false)) {
+                return 0;
+            }
+            in_block = false;
+        }
+
+        // Keep bursts short so NACKs are answered while the sequence is still going
+        uint32_t burst = tx->credits;
+
+        if (fc->retransmit && burst > CTP_TX_BATCH_SIZE) {
+            burst = CTP_TX_BATCH_SIZE;
+        }
+
+        if (in_block) {
+            ctp_delay_us(ctx, tx->st_min_us);
+        }
+
+        uint32_t sent = ctp_send_frames(ctx, &tx->enc, id, burst, tx->st_min_us, &failed);
+        in_block = true;
+
+        if (failed) {
+            return 0;
+        }
+
+        if (tx->credits != UINT32_MAX) {
+            tx->credits -= sent;
+        }
+
+        if (fc->retransmit) {
+            ctp_sender_poll(tx);
+        }
+
+        if (tx->aborted) {
+            return 0;
+        }
+    }
+
+    if (fc->retransmit && !ctp_sender_wait(tx, true)) {
+        return 0;
+    }
+
+    return tx->enc.offset;
+}
+
+uint32_t ctp_send_data_sequence(CTP_Context *ctx, uint32_t id, uint8_t *data, uint16_t length, bool fd) {
+    CTP_Sender tx;
+
+    ctp_encoder_init(&tx.enc, data, length, fd);
+
+    return ctp_send_encoded(ctx, id, &tx);
+}
+
+// Send length bytes as a single sequence started by an extended START frame,
+// instead of the independent 64 KB sequences of ctp_send(). Sequence numbers
+// wrap around, receivers place frames by their position in the sequence.
+// Returns length, or 0 if the receiver aborts or stops answering. Compact
+// frames can't be retransmitted, with retransmission enabled
+// CTP_EXT_FLAG_COMPACT is ignored.
+uint32_t ctp_send_extended(CTP_Context *ctx, uint32_t id, const uint8_t *data, uint32_t length, bool fd, uint8_t flags) {
+    CTP_Sender tx;
+
+    if (ctx->flow_control.retransmit) {
+        flags &= ~CTP_EXT_FLAG_COMPACT;
+    }
+
+    ctp_encoder_init_extended(&tx.enc, data, length, fd, flags);
+
+    return ctp_send_encoded(ctx, id, &tx) == tx.enc.length ? length : 0;
+}
+
+uint32_t ctp_send(CTP_Context *ctx, uint32_t id, uint8_t *data, uint32_t length, bool fd) {
     uint32_t bytes_sent = 0;
     uint32_t max_len;
 
@@ -206,10 +1814,110 @@ uint32_t ctp_send(uint32_t id, uint8_t *data, uint32_t length, bool fd) {
 
     while (length > 0) {
         uint16_t chunk_length = (length > (max_len)) ? (max_len) : length;
-        bytes_sent += ctp_send_data_sequence(id, data, chunk_length, fd);
+        uint32_t sequence_sent = ctp_send_data_sequence(ctx, id, data, chunk_length, fd);
+        bytes_sent += sequence_sent;
+
+        if (sequence_sent < chunk_length) {
+            break;  // The receiver aborted the transfer
+        }
+
         data += chunk_length;
         length -= chunk_length;
     }
 
     return bytes_sent;
 }
+
+// Length a frame of len bytes is sent with
+uint8_t ctp_padded_length(const CTP_Padding *padding, uint8_t len) {
+    // Classic lengths are legal as they are, the common case
+    if (len <= 8 && len >= padding->min_length) {
+        return len;
+    }
+
+    return ctp_dlc_to_length(ctp_length_to_dlc((len < padding->min_length) ? padding->min_length : len));
+}
+
+// Pad the len bytes in data, which must hold CAN_MAX_DATA_LENGTH bytes, with
+// the padding byte. Returns the padded length.
+uint8_t ctp_pad_frame(const CTP_Padding *padding, uint8_t *data, uint8_t len) {
+    if (len <= 8 && len >= padding->min_length) {
+        return len;
+    }
+
+    uint8_t padded = ctp_padded_length(padding, len);
+
+    memset(&data[len], padding->value, padded - len);
+    return padded;
+}
+
+// Data length code of the smallest CAN FD frame holding length bytes, frames
+// are padded up to it
+uint8_t ctp_length_to_dlc(uint8_t length) {
+    static const uint8_t fd_lengths[] = {12, 16, 20, 24, 32, 48};
+
+    if (length <= 8) {
+        return length;
+    }
+
+    for (uint32_t i = 0; i < sizeof(fd_lengths); i++) {
+        if (length <= fd_lengths[i]) {
+            return 9 + i;
+        }
+    }
+
+    return 15;
+}
+
+// Payload length of a CAN FD data length code
+uint8_t ctp_dlc_to_length(uint8_t dlc) {
+    static const uint8_t lengths[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+
+    return lengths[dlc & 0x0F];
+}
+
+// CRC-32 (IEEE 802.3) of data, continuing from crc. Pass 0 to start.
+uint32_t ctp_crc32(uint32_t crc, const uint8_t *data, uint32_t length) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+
+    crc = ~crc;
+    for (uint32_t i = 0; i < length; i++) {
+        crc = (crc >> 4) ^ table[(crc ^ data[i]) & 0x0F];
+        crc = (crc >> 4) ^ table[(crc ^ (data[i] >> 4)) & 0x0F];
+    }
+
+    return ~crc;
+}
+
+// Multiply a and b modulo the CRC-32 polynomial, in the reflected bit order
+static uint32_t ctp_crc32_multmodp(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+
+    for (uint32_t m = 1u << 31; m != 0; m >>= 1) {
+        if (a & m) {
+            product ^= b;
+        }
+        b = (b & 1) ? (b >> 1) ^ 0xEDB88320 : b >> 1;
+    }
+
+    return product;
+}
+
+// Advance a bare CRC-32 (no pre or post inversion) over n zero bytes. Lets a
+// block that arrives out of order be folded into the CRC of the whole sequence.
+uint32_t ctp_crc32_shift(uint32_t crc, uint32_t n) {
+    uint32_t power = 1u << 23;          // x^8, one byte
+
+    while (n != 0) {
+        if (n & 1) {
+            crc = ctp_crc32_multmodp(power, crc);
+        }
+        power = ctp_crc32_multmodp(power, power);
+        n >>= 1;
+    }
+
+    return crc;
+}
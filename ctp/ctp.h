@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 // Define maximum CAN data length
 #define CAN_MAX_DATA_LENGTH 64
@@ -18,9 +19,90 @@
 #define CTP_FD_END_DATA_LENGTH 63
 #define CTP_FD_ERROR_DATA_LENGTH 63
 
+#define CTP_EXT_START_DATA_SIZE 2
+#define CTP_FD_EXT_START_DATA_SIZE 58
+
 #define CTP_START_FRAME_HEADER_SIZE 3
+#define CTP_EXT_START_FRAME_HEADER_SIZE 6
 #define CTP_CONSECUTIVE_FRAME_HEADER_SIZE 2
 #define CTP_END_FRAME_HEADER_SIZE 1
+#define CTP_FLOW_CONTROL_FRAME_LENGTH 4
+#define CTP_NACK_FRAME_LENGTH 3
+
+// Sequence numbers are 8 bit, so a receiver can only track the last 256
+// CONSECUTIVE frames for retransmission
+#define CTP_RETRANSMIT_WINDOW 256
+
+// Largest payload a single sequence can carry
+#define CTP_MAX_SEQUENCE_LENGTH (CTP_START_DATA_SIZE + MAX_SEQUENCE_NUM * CTP_CONSECUTIVE_DATA_LENGTH + CTP_END_DATA_LENGTH)
+#define CTP_FD_MAX_SEQUENCE_LENGTH (CTP_FD_START_DATA_SIZE + MAX_SEQUENCE_NUM * CTP_FD_CONSECUTIVE_DATA_LENGTH + CTP_FD_END_DATA_LENGTH)
+
+// Extended START flags
+#define CTP_EXT_FLAG_CRC32 0x01         // A CRC-32 of the payload follows it in the sequence
+#define CTP_EXT_FLAG_COMPACT 0x02       // The frames after START use compact framing
+#define CTP_EXT_FLAG_LZ 0x04            // The payload is an LZ compressed stream, see ctp_lz.h
+#define CTP_EXT_FLAGS_SUPPORTED (CTP_EXT_FLAG_CRC32 | CTP_EXT_FLAG_COMPACT | CTP_EXT_FLAG_LZ)
+#define CTP_CRC_LENGTH 4
+
+// Compact framing, ISO-TP style. Every frame after the extended START frame
+// starts with a single PCI byte, 0x2N with a 4 bit sequence number N, and
+// carries 7 bytes instead of 6 (63 on CAN FD). The last frame carries the
+// rest of the sequence, there is no separate END frame type.
+#define CTP_COMPACT_PCI 0x20
+#define CTP_COMPACT_PCI_MASK 0xF0
+#define CTP_COMPACT_SEQUENCE_MASK 0x0F
+#define CTP_COMPACT_HEADER_SIZE 1
+#define CTP_COMPACT_DATA_LENGTH 7
+#define CTP_FD_COMPACT_DATA_LENGTH 63
+
+// Reassembly table sizing, override at compile time to trade memory for sessions.
+// The table holds 2^CTP_RX_TABLE_BITS concurrent sessions.
+#ifndef CTP_RX_TABLE_BITS
+#define CTP_RX_TABLE_BITS 5
+#endif
+#define CTP_RX_TABLE_SIZE (1 << CTP_RX_TABLE_BITS)
+
+#ifndef CTP_RX_TABLE_BUFFER_SIZE
+#define CTP_RX_TABLE_BUFFER_SIZE CTP_FD_MAX_SEQUENCE_LENGTH
+#endif
+
+#define CTP_RX_TABLE_INDEX_BITS (CTP_RX_TABLE_BITS + 1)
+#define CTP_RX_TABLE_INDEX_SIZE (1 << CTP_RX_TABLE_INDEX_BITS)
+
+// Frames encoded per send_batch call on drivers that implement it
+#ifndef CTP_TX_BATCH_SIZE
+#define CTP_TX_BATCH_SIZE 32
+#endif
+
+// Frames read ahead from drivers that implement receive_batch
+#ifndef CTP_RX_BATCH_SIZE
+#define CTP_RX_BATCH_SIZE 16
+#endif
+
+// 29 bit ID ranges an acceptance filter holds, adjacent ranges are merged.
+// Also the most ranges handed to a driver's set_filter.
+#ifndef CTP_FILTER_MAX_RANGES
+#define CTP_FILTER_MAX_RANGES 32
+#endif
+
+// Byte frames are padded with. Alternating bits never need a stuff bit, so
+// padding doesn't lengthen frames on the wire beyond its own bits.
+#ifndef CTP_PADDING_BYTE
+#define CTP_PADDING_BYTE 0xCC
+#endif
+
+// CAN IDs are 11 bit IDs unless CTP_ID_EXTENDED is set, then the lower 29
+// bits are sent as an extended ID. Drivers translate the flag to and from
+// their own frame format, so one context can use both formats.
+#define CTP_ID_EXTENDED 0x80000000u
+#define CTP_ID_IS_EXTENDED(id) (((id) & CTP_ID_EXTENDED) != 0)
+#define CTP_STANDARD_ID_MAX 0x7FF
+#define CTP_EXTENDED_ID_MAX 0x1FFFFFFF
+
+// J1939 addressing in a 29 bit ID: priority, PGN and source address. PDU1
+// PGNs (PF below 240) carry the destination address in the PS byte.
+#define CTP_J1939_PDU2_FORMAT 240
+#define CTP_J1939_GLOBAL_ADDRESS 0xFF
 
 
 // Define CTP frame types
@@ -29,6 +111,9 @@ typedef enum {
     CTP_CONSECUTIVE_FRAME,
     CTP_END_FRAME,
     CTP_ERROR_FRAME,
+    CTP_FLOW_CONTROL_FRAME,
+    CTP_EXT_START_FRAME,                // [flags][32 bit length], starts sequences beyond 64 KB
+    CTP_FRAME_TYPE_COUNT
 } CTP_FrameType;
 
 // Define CTP error codes
@@ -36,9 +121,19 @@ typedef enum {
     CTP_MESSAGE_TIMEOUT,
     CTP_INVALID_SEQUENCE_NUMBER,
     CTP_INVALID_FRAME_TYPE,
-    CTP_INVALID_FRAME_LENGTH
+    CTP_INVALID_FRAME_LENGTH,
+    CTP_INVALID_CHECKSUM,
+    CTP_SINK_ABORTED
 } CTP_ErrorCode;
 
+// Flow control status sent by the receiver, ISO-TP style
+typedef enum {
+    CTP_FC_CONTINUE,                    // Send the next block
+    CTP_FC_WAIT,                        // Keep waiting for another flow control frame
+    CTP_FC_OVERFLOW,                    // The sequence doesn't fit, abort
+    CTP_FC_COMPLETE,                    // Sequence received, only sent with retransmission enabled
+} CTP_FlowStatus;
+
 // CTP frame structure
 typedef struct {
     uint32_t id; // CAN ID
@@ -59,22 +154,309 @@ typedef struct {
             CTP_ErrorCode errorCode;
             uint8_t data[CTP_FD_ERROR_DATA_LENGTH];
         } error;
+        struct {
+            CTP_FlowStatus status;
+            uint8_t block_size;
+            uint8_t st_min;
+        } flow_control;
     } payload;
 } CTP_Frame;
 
+// Raw CAN frame as exchanged with the driver
+typedef struct {
+    uint32_t id;                        // CTP_ID_EXTENDED set for 29 bit IDs
+    uint8_t len;
+    uint8_t data[CAN_MAX_DATA_LENGTH];
+    uint64_t timestamp_us;              // Receive time from the driver, 0 when not available
+} CTP_CanFrame;
 
-// Protocol interface functions
-void ctp_send_frame(const CTP_Frame *frame, uint8_t len);
-uint32_t ctp_send_data_sequence(uint32_t id, uint8_t *data, uint16_t length, bool fd);
-uint32_t ctp_send(uint32_t id, uint8_t *data, uint32_t length, bool fd);
-int32_t ctp_receive_seq(uint8_t* buffer, uint32_t buffer_size, bool fd);
-int32_t ctp_receive(uint8_t *buffer, uint32_t length, bool fd);
-
-// CAN driver interface functions, this functions must be implemented by the user
-// and is used by the protocol to send and receive CAN messages
+// Inclusive range of CAN IDs of one format, CTP_ID_EXTENDED is set on both
+// ends of 29 bit ranges.
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+} CTP_IdRange;
+
+// CAN driver interface, this must be implemented by the user for each backend
+// and is used by the protocol to send and receive CAN messages. handle is the
+// driver's own per-channel state and is passed back on every call.
 // Don't pass all CAN messages to the protocol, only the ones with the correct ID
-// or the ids/messages set aside for the protocol
-bool send_ctp_message(uint32_t id, uint8_t *data, uint8_t length);
-bool receive_ctp_message(uint32_t *id, uint8_t *data, uint8_t *length);
+// or the ids/messages set aside for the protocol. Register them with
+// ctp_filter_add(), drivers with set_filter drop the rest before the CTP sees it.
+typedef struct {
+    bool (*send)(void *handle, uint32_t id, const uint8_t *data, uint8_t length);
+    bool (*receive)(void *handle, uint32_t *id, uint8_t *data, uint8_t *length);
+
+    // Optional, leave NULL when the backend doesn't support them
+    uint32_t (*send_batch)(void *handle, const CTP_CanFrame *frames, uint32_t count);   // Returns frames sent
+    uint32_t (*receive_batch)(void *handle, CTP_CanFrame *frames, uint32_t count);      // Returns frames read
+    uint64_t (*now_us)(void *handle);                                                   // Monotonic clock
+    void (*sleep_us)(void *handle, uint32_t us);                                        // Paces frames
+    bool (*set_filter)(void *handle, const CTP_IdRange *ranges, uint32_t count);        // Accept only ranges, all for count 0
+} CTP_Driver;
+
+typedef struct {
+    uint8_t priority;                   // 0 is the highest
+    uint32_t pgn;                       // Parameter group number, 18 bit
+    uint8_t destination;                // CTP_J1939_GLOBAL_ADDRESS for PDU2 PGNs
+    uint8_t source;
+} CTP_J1939Address;
+
+// Padding of outgoing frames. Frames longer than 8 bytes are always padded up
+// to the next length a CAN FD DLC can express, the smallest legal frame.
+// Shorter frames go out as they are unless min_length asks for more, e.g. 8
+// for ECUs that only take padded classic frames.
+typedef struct {
+    uint8_t value;                      // CTP_PADDING_BYTE by default
+    uint8_t min_length;                 // 0 sends frames as short as possible
+} CTP_Padding;
+
+// Opt-in flow control, must be enabled on both ends. A receiver answers the
+// START frame and every block_size CONSECUTIVE frames with a flow control frame
+// on tx_id, a sender waits for these on rx_id before sending the next block.
+//
+// With retransmit set a receiver NACKs lost CONSECUTIVE frames on tx_id with an
+// ERROR frame [CTP_INVALID_SEQUENCE_NUMBER][sequence] and confirms the sequence
+// with CTP_FC_COMPLETE. The sender resends only the NACKed frames and waits for
+// the confirmation before returning.
+typedef struct {
+    bool enabled;
+    bool retransmit;
+    uint32_t tx_id;                     // CAN ID this node sends flow control frames on
+    uint32_t rx_id;                     // CAN ID this node expects flow control frames on
+    uint8_t block_size;                 // Frames per block requested as a receiver, 0 for no limit
+    uint8_t st_min;                     // Separation time requested as a receiver, ISO-TP encoded
+    uint32_t timeout_us;                // How long a sender waits for the receiver, 0 waits forever
+} CTP_FlowControl;
+
+// Receive timeouts, 0 disables them. Both need a driver with a now_us clock.
+typedef struct {
+    uint32_t frame_us;                  // N_Cr: longest gap between two frames of a sequence
+    uint32_t call_us;                   // Longest a blocking receive waits for a whole sequence
+} CTP_Timeouts;
+
+// Reassembly latency histogram, from START frame to completion. Bucket 0
+// counts sequences under 1 us, bucket n those from 2^(n-1) up to 2^n us and
+// the last one everything longer. Taken from the frames' receive timestamps,
+// or from the driver's now_us clock when frames carry none.
+#ifndef CTP_LATENCY_BUCKETS
+#define CTP_LATENCY_BUCKETS 24
+#endif
+
+// Counters of one channel. They are updated with relaxed atomics, so threads
+// sharing a context, e.g. the workers of a pool, can count without a lock.
+// Read them through ctp_stats_snapshot().
+typedef struct {
+    _Atomic uint64_t frames_tx[CTP_FRAME_TYPE_COUNT];
+    _Atomic uint64_t frames_rx[CTP_FRAME_TYPE_COUNT];
+    _Atomic uint64_t bytes_tx;          // CAN data bytes, all frames
+    _Atomic uint64_t bytes_rx;
+    _Atomic uint64_t completed;         // Sequences received
+    _Atomic uint64_t sequence_errors;   // Sequences failed on a sequence number
+    _Atomic uint64_t overflows;         // Sequences longer than the buffer or than announced
+    _Atomic uint64_t timeouts;          // Receive and flow control timeouts
+    _Atomic uint64_t aborted;           // Sequences failed for any other reason, overflows included
+    _Atomic uint64_t filtered;          // Frames the acceptance filter dropped in software
+    _Atomic uint64_t latency_us[CTP_LATENCY_BUCKETS];
+} CTP_Stats;
+
+// Copy of the counters taken at one point in time
+typedef struct {
+    uint64_t frames_tx[CTP_FRAME_TYPE_COUNT];
+    uint64_t frames_rx[CTP_FRAME_TYPE_COUNT];
+    uint64_t bytes_tx;
+    uint64_t bytes_rx;
+    uint64_t completed;
+    uint64_t sequence_errors;
+    uint64_t overflows;
+    uint64_t timeouts;
+    uint64_t aborted;
+    uint64_t filtered;
+    uint64_t latency_us[CTP_LATENCY_BUCKETS];
+} CTP_StatsSnapshot;
+
+// IDs a context accepts. 11 bit IDs are looked up in a bitmap, 29 bit IDs by
+// binary search over sorted, disjoint ranges. Accepts every ID until the
+// first one is added.
+typedef struct {
+    bool enabled;
+    uint32_t standard[(CTP_STANDARD_ID_MAX + 1) / 32];
+    CTP_IdRange extended[CTP_FILTER_MAX_RANGES];
+    uint32_t extended_count;
+} CTP_Filter;
+
+// Protocol state of one CAN channel. Every ctp_* call takes a context, so a
+// process can drive several channels and backends from parallel threads as
+// long as each context is only used by one thread at a time.
+typedef struct {
+    const CTP_Driver *driver;
+    void *handle;
+
+    // Frames already read through receive_batch but not yet consumed
+    CTP_CanFrame rx_batch[CTP_RX_BATCH_SIZE];
+    uint32_t rx_batch_count;
+    uint32_t rx_batch_pos;
+
+    CTP_FlowControl flow_control;
+    CTP_Timeouts timeouts;
+    CTP_Filter filter;
+    CTP_Padding padding;
+    CTP_Stats stats;
+} CTP_Context;
+
+// Encoder state of a single CTP sequence. Each call to ctp_encoder_next()
+// writes the header and payload of the next frame straight into the caller's
+// buffer, e.g. a driver TX slot or an entry of a frame ring.
+typedef struct {
+    const uint8_t *data;
+    uint32_t length;                    // Bytes in the sequence, the trailer included
+    uint32_t offset;                    // Bytes encoded so far
+    uint32_t consecutive_count;         // CONSECUTIVE frames encoded so far
+    uint8_t trailer[CTP_CRC_LENGTH];    // Sent after the caller's data
+    uint8_t trailer_length;
+    uint8_t flags;                      // Extended START flags
+    bool extended;
+    bool started;
+    bool fd;
+    CTP_Padding padding;                // Default padding, senders use their context's
+} CTP_Encoder;
+
+// Result of feeding a single CAN frame to a receiver
+typedef enum {
+    CTP_RX_IN_PROGRESS,
+    CTP_RX_COMPLETE,
+    CTP_RX_ERROR,
+} CTP_RxStatus;
+
+// Receives the payload of a sequence piece by piece. offset is the position of
+// data in the sequence, pieces come in order unless retransmission is enabled.
+// Return false to abort the sequence.
+typedef bool (*CTP_Sink)(void *user, uint32_t offset, const uint8_t *data, uint32_t length);
+
+// Receive times of a sequence's frames, from the timestamps the driver puts
+// on them. Times stay 0 when the driver doesn't timestamp frames.
+typedef struct {
+    uint64_t first_us;                  // START frame
+    uint64_t last_us;                   // Latest frame, the completing one once done
+    uint64_t max_gap_us;                // Longest time between two frames of the sequence
+    uint32_t frames;                    // Frames of the sequence, duplicates included
+} CTP_RxTiming;
+
+// Reassembly state of a single CTP sequence. The receiver is fed one CAN frame
+// at a time with ctp_rx_feed() and never touches the driver, so it can be
+// serviced from a poll/epoll loop without blocking.
+typedef struct {
+    CTP_Context *ctx;                   // Channel the sequence arrives on, may be NULL
+    uint8_t *buffer;
+    uint32_t buffer_size;
+    CTP_Sink sink;                      // Takes the payload instead of buffer when set
+    void *sink_user;
+    uint32_t id;                        // CAN ID of the sequence in progress
+    uint32_t received_length;           // Valid once CTP_RX_COMPLETE is returned
+    uint32_t expected_total_length;     // Payload length announced by the START frame
+    uint8_t start_length;               // Payload bytes carried by the START frame
+    uint8_t flags;                      // Extended START flags
+    uint8_t trailer[CTP_CRC_LENGTH];
+    uint8_t trailer_length;
+    uint32_t crc;                       // CRC-32 of the payload in order, lost frames as zeros
+    uint32_t crc_late;                  // CRC terms of frames that arrived out of order
+    uint64_t deadline_us;               // When the next frame is due, 0 without a frame timeout
+    uint64_t start_us;                  // When the START frame arrived, 0 without a clock
+    CTP_RxTiming timing;
+    uint32_t consecutive_frames;        // CONSECUTIVE frames in the sequence
+    uint32_t next_frame;                // Index of the next CONSECUTIVE frame not seen yet
+    uint32_t missing_count;             // NACKed frames not retransmitted yet
+    uint32_t missing[CTP_RETRANSMIT_WINDOW / 32];   // NACKed frames by index modulo the window
+    uint8_t block_count;                // CONSECUTIVE frames since the last flow control frame
+    bool start_frame_received;
+    bool end_received;
+    bool done;                          // Sequence completed or failed, next START restarts
+    bool fd;
+    CTP_ErrorCode error;                // Valid once CTP_RX_ERROR is returned
+} CTP_Receiver;
+
+// A session slot of the reassembly table, with its preallocated buffer
+typedef struct {
+    CTP_Receiver rx;
+    uint8_t buffer[CTP_RX_TABLE_BUFFER_SIZE];
+} CTP_RxSlot;
+
+// Reassembly table keeping an independent session per CAN ID. IDs are mapped to
+// slots through an open-addressing index with linear probing, all storage is
+// preallocated so feeding frames never allocates. Keys hold the channel in the
+// upper 32 bits, so one table can serve several CAN channels.
+typedef struct {
+    uint64_t keys[CTP_RX_TABLE_INDEX_SIZE];
+    int16_t index[CTP_RX_TABLE_INDEX_SIZE];     // Slot number, -1 when empty
+    uint16_t free_slots[CTP_RX_TABLE_SIZE];
+    uint16_t free_count;
+    CTP_RxSlot slots[CTP_RX_TABLE_SIZE];
+    CTP_Context *ctx;
+    bool fd;
+} CTP_RxTable;
+
+// Protocol interface functions
+void ctp_init(CTP_Context *ctx, const CTP_Driver *driver, void *handle);
+bool ctp_read_frame(CTP_Context *ctx, CTP_CanFrame *frame);
+void ctp_send_frame(CTP_Context *ctx, const CTP_Frame *frame, uint8_t len);
+uint32_t ctp_send_data_sequence(CTP_Context *ctx, uint32_t id, uint8_t *data, uint16_t length, bool fd);
+uint32_t ctp_send(CTP_Context *ctx, uint32_t id, uint8_t *data, uint32_t length, bool fd);
+uint32_t ctp_send_extended(CTP_Context *ctx, uint32_t id, const uint8_t *data, uint32_t length, bool fd, uint8_t flags);
+int32_t ctp_receive_seq(CTP_Context *ctx, uint8_t* buffer, uint32_t buffer_size, bool fd);
+int32_t ctp_receive_seq_timed(CTP_Context *ctx, uint8_t *buffer, uint32_t buffer_size, bool fd, CTP_RxTiming *timing);
+int32_t ctp_receive(CTP_Context *ctx, uint8_t *buffer, uint32_t length, bool fd);
+int32_t ctp_receive_sink(CTP_Context *ctx, CTP_Sink sink, void *user, bool fd);
+int32_t ctp_receive_rx(CTP_Context *ctx, CTP_Receiver *rx);
+
+// Frame encoding interface
+void ctp_encoder_init(CTP_Encoder *enc, const uint8_t *data, uint16_t length, bool fd);
+void ctp_encoder_init_extended(CTP_Encoder *enc, const uint8_t *data, uint32_t length, bool fd, uint8_t flags);
+uint8_t ctp_encoder_next(CTP_Encoder *enc, uint8_t *out);
+uint32_t ctp_sequence_frame_count(uint16_t length, bool fd);
+uint32_t ctp_encode_sequence(uint32_t id, const uint8_t *data, uint16_t length, bool fd, CTP_CanFrame *frames, uint32_t max_frames);
+uint32_t ctp_send_batch(CTP_Context *ctx, const CTP_CanFrame *frames, uint32_t count);
+uint32_t ctp_st_min_us(uint8_t st_min);
+uint8_t ctp_padded_length(const CTP_Padding *padding, uint8_t len);
+uint8_t ctp_pad_frame(const CTP_Padding *padding, uint8_t *data, uint8_t len);
+
+// Extended ID interface
+uint32_t ctp_j1939_id(const CTP_J1939Address *address);
+CTP_J1939Address ctp_j1939_address(uint32_t id);
+uint32_t ctp_j1939_reply_id(uint32_t id);
+
+// Acceptance filter interface
+bool ctp_filter_add(CTP_Context *ctx, uint32_t id);
+bool ctp_filter_add_range(CTP_Context *ctx, uint32_t first, uint32_t last);
+void ctp_filter_clear(CTP_Context *ctx);
+bool ctp_filter_match(const CTP_Filter *filter, uint32_t id);
+uint32_t ctp_filter_ranges(const CTP_Filter *filter, CTP_IdRange *ranges, uint32_t max_ranges);
+
+void ctp_stats_snapshot(CTP_Context *ctx, CTP_StatsSnapshot *snapshot);
+void ctp_stats_reset(CTP_Context *ctx);
+
+uint8_t ctp_length_to_dlc(uint8_t length);
+uint8_t ctp_dlc_to_length(uint8_t dlc);
+
+uint32_t ctp_crc32(uint32_t crc, const uint8_t *data, uint32_t length);
+uint32_t ctp_crc32_shift(uint32_t crc, uint32_t n);
+
+// Non-blocking receive interface
+void ctp_rx_init(CTP_Receiver *rx, CTP_Context *ctx, uint8_t *buffer, uint32_t buffer_size, bool fd);
+void ctp_rx_init_sink(CTP_Receiver *rx, CTP_Context *ctx, CTP_Sink sink, void *user, bool fd);
+void ctp_rx_reset(CTP_Receiver *rx);
+CTP_RxStatus ctp_rx_feed(CTP_Receiver *rx, uint32_t id, const uint8_t *data, uint8_t len);
+CTP_RxStatus ctp_rx_feed_frame(CTP_Receiver *rx, const CTP_CanFrame *frame);
+bool ctp_rx_expire(CTP_Receiver *rx);
+
+// Multi-session reassembly interface
+void ctp_rx_table_init(CTP_RxTable *table, CTP_Context *ctx, bool fd);
+CTP_RxStatus ctp_rx_table_feed(CTP_RxTable *table, uint32_t id, const uint8_t *data, uint8_t len, CTP_Receiver **session);
+CTP_RxStatus ctp_rx_table_feed_channel(CTP_RxTable *table, CTP_Context *ctx, uint32_t channel, uint32_t id,
+                                       const uint8_t *data, uint8_t len, CTP_Receiver **session);
+CTP_RxStatus ctp_rx_table_feed_frame(CTP_RxTable *table, CTP_Context *ctx, uint32_t channel, const CTP_CanFrame *frame,
+                                     CTP_Receiver **session);
+CTP_Receiver *ctp_rx_table_find(CTP_RxTable *table, uint32_t id);
+void ctp_rx_table_remove(CTP_RxTable *table, uint32_t id);
+uint32_t ctp_rx_table_expire(CTP_RxTable *table);
 
 #endif
@@ -5,57 +5,17 @@
 #include <stdbool.h>
 
 #include "ctp.h"  
-#include "PCBUSB.h"
+#include "ctp_driver.h"
+#include "ctp_timing.h"
 
 
-// Global pcan channel for processes to use
-uint32_t pcan_channel = PCAN_USBBUS1;
+// Channel state for the process, the CLI drives a single interface
+PCAN_Channel pcan;
+CTP_Context ctx;
 
 
-// Driver function for PCAN-USB MAC, used by the CTP to send frames to the CAN bus
-bool send_ctp_message(uint32_t id, uint8_t *data, uint8_t length) {
-    TPCANStatus status;
-    TPCANMsg message;
-
-    message.ID = id;
-    message.LEN = length;
-    message.MSGTYPE = PCAN_MESSAGE_STANDARD;
-    memcpy(message.DATA, data, message.LEN);
-
-    status = CAN_Write(pcan_channel, &message);
-
-    if (status != PCAN_ERROR_OK) {
-        printf("Failed to send CAN message: 0x%x\n", status);
-        return false;
-    }
-
-    return true;
-}
-
-// Driver function for PCAN-USB MAC, used by the CTP to get frames from the CAN bus
-bool receive_ctp_message(uint32_t *id, uint8_t *data, uint8_t *length) {
-    TPCANMsg message;
-    TPCANStatus status;
-
-    status = CAN_Read(pcan_channel, &message, NULL);
-
-    if (status == PCAN_ERROR_OK) {        
-        *id = message.ID;
-        *length = message.LEN;
-        memcpy(data, message.DATA, message.LEN);
-    } 
-    else if (status == PCAN_ERROR_QRCVEMPTY) {
-        return false;
-    } 
-    else {
-        return false;
-    }
-
-    return true;
-}
-
 void send_data(uint32_t id, const char* data) {
-    if (ctp_send(id, (uint8_t *)data, strlen(data), false) <= 0) {
+    if (ctp_send(&ctx, id, (uint8_t *)data, strlen(data), pcan.fd) <= 0) {
         printf("Failed to send data!\n");
     } else {
         printf("Data sent successfully.\n");
@@ -66,7 +26,7 @@ void receive_data() {
     uint8_t buffer[512];  // Adjust the buffer size as needed.
 
     while (1) {
-        int32_t received_bytes = ctp_receive(buffer, sizeof(buffer), false);
+        int32_t received_bytes = ctp_receive(&ctx, buffer, sizeof(buffer), pcan.fd);
         
         if (received_bytes > 0) {
             printf("Received data: %.*s\n", received_bytes, buffer);
@@ -79,54 +39,41 @@ void receive_data() {
     }
 }
 
-uint32_t init_can(uint32_t channel, uint32_t baud_rate) {
-    uint32_t status = false;
-
-    uint32_t channel_map[] = {
-        PCAN_USBBUS1,
-        PCAN_USBBUS2,
-        PCAN_USBBUS3,
-        PCAN_USBBUS4,
-        PCAN_USBBUS5,
-        PCAN_USBBUS6,
-        PCAN_USBBUS7,
-        PCAN_USBBUS8
-    };
-
-    if (channel > 7) {
-        printf("Invalid channel: %d\n", channel);
-        return 1;
-    }
-
-    switch(baud_rate) {
-        case 1000:
-            baud_rate = PCAN_BAUD_1M;
-            break;
+void estimate_transfer(uint32_t size, const CTP_BusTiming *timing, const CTP_FlowControl *fc, uint32_t period_ms) {
+    CTP_TimingEstimate estimate;
 
-        case 500:
-            baud_rate = PCAN_BAUD_500K;
-            break;
+    ctp_timing_estimate(timing, fc, size, &estimate);
 
-        case 250:
-            baud_rate = PCAN_BAUD_250K;
-            break;
+    printf("Sequences:      %u\n", estimate.sequences);
+    printf("Data frames:    %u\n", estimate.frames);
+    printf("Flow control:   %u frames\n", estimate.flow_control_frames);
+    printf("Wire bits:      %llu\n", (unsigned long long)estimate.bits);
+    printf("Bus busy:       %.3f ms\n", estimate.busy_ns / 1e6);
+    printf("Transfer time:  %.3f ms\n", estimate.time_ns / 1e6);
+    printf("Throughput:     %.1f B/s\n", estimate.throughput);
+    printf("Bus load:       %.1f %% during the transfer\n", estimate.bus_load * 100);
 
-        default:
-            printf("Invalid baud rate: %d\n", baud_rate);
-            return 1;
+    if (period_ms > 0) {
+        printf("                %.1f %% when repeated every %u ms\n", estimate.busy_ns / (period_ms * 1e4), period_ms);
     }
+}
 
-    pcan_channel = channel_map[channel];
+// A data baud rate selects CAN FD
+uint32_t init_can(uint32_t channel, uint32_t baud_rate, uint32_t data_baud_rate) {
+    uint32_t status;
 
-    status = CAN_Initialize(pcan_channel, baud_rate, 0, 0, 0);
-    printf("Initialize CAN, Status = 0x%x\n", status);
+    if (data_baud_rate > 0) {
+        status = init_pcan_fd(&pcan, channel, baud_rate, data_baud_rate);
+    }
+    else {
+        status = init_pcan(&pcan, channel, baud_rate);
+    }
 
-    if (status != PCAN_ERROR_OK) {
-            printf("Failed to initialize CAN\n");
-            return 1;
+    if (status == 0) {
+        ctp_init(&ctx, &pcan_driver, &pcan);
     }
 
-    return 0;
+    return status;
 }
 
 void print_help() {
@@ -139,21 +86,41 @@ void print_help() {
     printf("Commands:\n");
     printf("  send                    Send a command.\n");
     printf("    --id <num>            Specify the ID for the send command.\n");
+    printf("    --ext                 Send the ID as a 29 bit ID.\n");
+    printf("    --pgn <num>           Send on the 29 bit J1939 ID of this PGN instead of --id.\n");
+    printf("    --sa <num>            J1939 source address.\n");
+    printf("    --da <num>            J1939 destination address, PDU1 PGNs only.\n");
+    printf("    --prio <num>          J1939 priority, 6 by default.\n");
     printf("    --data <string>       Specify the data for the send command.\n");
-    printf("  dump                    Dump the data.\n\n");
-
-    printf("Args for both send and dump:\n");
-    printf("    --baud <num>          Specify the baud rate.\n\n");
+    printf("  dump                    Dump the data.\n");
+    printf("  estimate                Estimate bus time and load of a transfer, no interface needed.\n");
+    printf("    --size <num>          Transfer size in bytes.\n");
+    printf("    --fd                  Send CAN FD frames.\n");
+    printf("    --ext                 Use 29 bit IDs.\n");
+    printf("    --pad <num>           Frames are padded to at least this many bytes.\n");
+    printf("    --bs <num>            Flow control block size of the receiver.\n");
+    printf("    --stmin <num>         Flow control separation time of the receiver, ISO-TP encoded.\n");
+    printf("    --period <ms>         Bus load when the transfer repeats with this period.\n\n");
+
+    printf("Args for send, dump and estimate:\n");
+    printf("    --baud <num>          Specify the baud rate.\n");
+    printf("    --data-baud <num>     CAN FD data phase baud rate, sends and receives CAN FD frames.\n\n");
 
     printf("Examples:\n");
     printf("  cli -i 0 send --id 123 --data \"hello\" --baud 250\n");
     printf("  cli -i 1 dump --baud 250\n");
+    printf("  cli -i 0 send --id 123 --data \"hello\" --baud 500 --data-baud 2000\n");
+    printf("  cli -i 0 send --pgn 0xDA00 --sa 0xF9 --da 0x17 --data \"hello\" --baud 250\n");
+    printf("  cli estimate --size 4096 --baud 500 --data-baud 2000 --bs 8\n");
 }
 
 int main(int argc, char *argv[]) {
     int interface = -1;
     int baud_rate = -1;
+    int data_baud_rate = 0;
     int id = -1;
+    bool extended = false;
+    CTP_J1939Address j1939 = {.priority = 6, .pgn = UINT32_MAX};
     char *data = NULL;
 
     if (argc < 2) {
@@ -178,6 +145,24 @@ int main(int argc, char *argv[]) {
                     if (++i < argc) {
                         id = atoi(argv[i]);
                     }
+                } else if (strcmp(argv[i], "--ext") == 0) {
+                    extended = true;
+                } else if (strcmp(argv[i], "--pgn") == 0) {
+                    if (++i < argc) {
+                        j1939.pgn = strtoul(argv[i], NULL, 0);
+                    }
+                } else if (strcmp(argv[i], "--sa") == 0) {
+                    if (++i < argc) {
+                        j1939.source = strtoul(argv[i], NULL, 0);
+                    }
+                } else if (strcmp(argv[i], "--da") == 0) {
+                    if (++i < argc) {
+                        j1939.destination = strtoul(argv[i], NULL, 0);
+                    }
+                } else if (strcmp(argv[i], "--prio") == 0) {
+                    if (++i < argc) {
+                        j1939.priority = atoi(argv[i]);
+                    }
                 } else if (strcmp(argv[i], "--data") == 0) {
                     if (++i < argc) {
                         data = argv[i];
@@ -186,34 +171,50 @@ int main(int argc, char *argv[]) {
                     if (++i < argc) {
                         baud_rate = atoi(argv[i]);
                     }
+                } else if (strcmp(argv[i], "--data-baud") == 0) {
+                    if (++i < argc) {
+                        data_baud_rate = atoi(argv[i]);
+                    }
                 } else {
                     break;
                 }
                 i++;
             }
-            if (id != -1 && data != NULL) {
-                uint32_t status = init_can(interface, baud_rate);
+            if ((id != -1 || j1939.pgn != UINT32_MAX) && data != NULL) {
+                uint32_t can_id = (j1939.pgn != UINT32_MAX) ? ctp_j1939_id(&j1939) : (uint32_t)id | (extended ? CTP_ID_EXTENDED : 0);
+                uint32_t status = init_can(interface, baud_rate, data_baud_rate);
 
                 if (status != 0) {
                     printf("Failed to initialize CAN\n");
                     return 1;
                 }
 
-                printf("Send command with id=%d, data=%s, baud_rate=%dk\n", id, data, baud_rate);
-                send_data(id, data);
+                printf("Send command with id=0x%X%s, data=%s, baud_rate=%dk\n", can_id & CTP_EXTENDED_ID_MAX,
+                       CTP_ID_IS_EXTENDED(can_id) ? " (29 bit)" : "", data, baud_rate);
+                send_data(can_id, data);
             } 
             else {
                 printf("Send command is missing required arguments.\n");
             }
         } 
         else if (strcmp(argv[i], "dump") == 0) {
-            if (++i < argc && (strcmp(argv[i], "--baud") == 0)) {
-                if (++i < argc) {
-                    baud_rate = atoi(argv[i]);
+            i++;
+            while (i < argc) {
+                if (strcmp(argv[i], "--baud") == 0) {
+                    if (++i < argc) {
+                        baud_rate = atoi(argv[i]);
+                    }
+                } else if (strcmp(argv[i], "--data-baud") == 0) {
+                    if (++i < argc) {
+                        data_baud_rate = atoi(argv[i]);
+                    }
+                } else {
+                    break;
                 }
+                i++;
             }
 
-            uint32_t status = init_can(interface, baud_rate);
+            uint32_t status = init_can(interface, baud_rate, data_baud_rate);
 
             if (status != 0) {
                 printf("Failed to initialize CAN\n");
@@ -223,6 +224,69 @@ int main(int argc, char *argv[]) {
             printf("Dump command with baud_rate=%dk\n", baud_rate);   
             receive_data();
         }
+        else if (strcmp(argv[i], "estimate") == 0) {
+            CTP_BusTiming timing = {0};
+            CTP_FlowControl fc = {0};
+            int size = -1;
+            int period_ms = 0;
+
+            i++;
+            while (i < argc) {
+                if (strcmp(argv[i], "--size") == 0) {
+                    if (++i < argc) {
+                        size = atoi(argv[i]);
+                    }
+                } else if (strcmp(argv[i], "--baud") == 0) {
+                    if (++i < argc) {
+                        baud_rate = atoi(argv[i]);
+                    }
+                } else if (strcmp(argv[i], "--data-baud") == 0) {
+                    if (++i < argc) {
+                        timing.data_bitrate = atoi(argv[i]) * 1000;
+                        timing.fd = true;
+                    }
+                } else if (strcmp(argv[i], "--fd") == 0) {
+                    timing.fd = true;
+                } else if (strcmp(argv[i], "--ext") == 0) {
+                    timing.extended_id = true;
+                } else if (strcmp(argv[i], "--pad") == 0) {
+                    if (++i < argc) {
+                        timing.min_length = atoi(argv[i]);
+                    }
+                } else if (strcmp(argv[i], "--bs") == 0) {
+                    if (++i < argc) {
+                        fc.block_size = atoi(argv[i]);
+                        fc.enabled = true;
+                    }
+                } else if (strcmp(argv[i], "--stmin") == 0) {
+                    if (++i < argc) {
+                        fc.st_min = strtol(argv[i], NULL, 0);
+                        fc.enabled = true;
+                    }
+                } else if (strcmp(argv[i], "--period") == 0) {
+                    if (++i < argc) {
+                        period_ms = atoi(argv[i]);
+                    }
+                } else {
+                    break;
+                }
+                i++;
+            }
+            if (size > 0 && baud_rate > 0) {
+                timing.bitrate = baud_rate * 1000;
+
+                printf("Estimate for %d bytes at %dk", size, baud_rate);
+                if (timing.data_bitrate > 0) {
+                    printf(", data phase at %uk", timing.data_bitrate / 1000);
+                }
+                printf("%s%s\n", timing.fd ? ", CAN FD" : "", timing.extended_id ? ", 29 bit IDs" : "");
+
+                estimate_transfer(size, &timing, &fc, period_ms);
+            }
+            else {
+                printf("Estimate command is missing required arguments.\n");
+            }
+        }
     }
 
     return 0;
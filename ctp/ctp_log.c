@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <syslog.h>
+#define CTP_LOG_HAVE_SYSLOG
+#endif
+
+#include "ctp_log.h"
+
+
+static CTP_LogSink log_sink = ctp_log_stderr;
+static void *log_user = NULL;
+
+// Route messages to sink, NULL drops them
+void ctp_log_set_sink(CTP_LogSink sink, void *user) {
+    log_sink = sink;
+    log_user = user;
+}
+
+const char *ctp_log_level_name(CTP_LogLevel level) {
+    switch (level) {
+        case CTP_LOG_LEVEL_ERROR:
+            return "ERROR";
+        case CTP_LOG_LEVEL_WARN:
+            return "WARN";
+        case CTP_LOG_LEVEL_INFO:
+            return "INFO";
+        case CTP_LOG_LEVEL_DEBUG:
+            return "DEBUG";
+        default:
+            return "NONE";
+    }
+}
+
+// Format a message and hand it to the sink. Use the CTP_LOG_* macros instead
+// of calling this directly, so disabled levels cost nothing.
+void ctp_log_write(CTP_LogLevel level, const char *format, ...) {
+    char message[CTP_LOG_LINE_MAX];
+    va_list args;
+
+    if (log_sink == NULL) {
+        return;
+    }
+
+    va_start(args, format);
+    int length = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if (length < 0) {
+        return;
+    }
+    if (length >= (int)sizeof(message)) {
+        length = sizeof(message) - 1;
+    }
+
+    log_sink(log_user, level, message, length);
+}
+
+void ctp_log_hex(CTP_LogLevel level, const char *prefix, const uint8_t *data, uint32_t length) {
+    static const char digits[] = "0123456789ABCDEF";
+    char line[3 * 16 + 1];
+
+    for (uint32_t offset = 0; offset < length; offset += 16) {
+        uint32_t n = (length - offset > 16) ? 16 : length - offset;
+        uint32_t pos = 0;
+
+        for (uint32_t i = 0; i < n; i++) {
+            line[pos++] = digits[data[offset + i] >> 4];
+            line[pos++] = digits[data[offset + i] & 0x0F];
+            line[pos++] = ' ';
+        }
+        line[pos - 1] = '\0';
+
+        ctp_log_write(level, "%s%04X: %s", prefix, (unsigned)offset, line);
+    }
+}
+
+void ctp_log_stderr(void *user, CTP_LogLevel level, const char *message, size_t length) {
+    (void)user;
+
+    fprintf(stderr, "[%s] %.*s\n", ctp_log_level_name(level), (int)length, message);
+}
+
+// Hands messages to the system logger, falls back to stderr where there is none
+void ctp_log_syslog(void *user, CTP_LogLevel level, const char *message, size_t length) {
+    (void)user;
+
+#ifdef CTP_LOG_HAVE_SYSLOG
+    static const int priorities[] = {LOG_DEBUG, LOG_ERR, LOG_WARNING, LOG_INFO, LOG_DEBUG};
+
+    syslog(priorities[level], "%.*s", (int)length, message);
+#else
+    ctp_log_stderr(user, level, message, length);
+#endif
+}
+
+void ctp_log_ring_init(CTP_LogRing *ring, char *buffer, uint32_t size) {
+    ring->buffer = buffer;
+    ring->size = size;
+    ring->written = 0;
+}
+
+static void ctp_log_ring_put(CTP_LogRing *ring, const char *data, size_t length) {
+    // Only the tail of a message longer than the whole ring survives
+    if (length > ring->size) {
+        ring->written += length - ring->size;
+        data += length - ring->size;
+        length = ring->size;
+    }
+
+    uint32_t pos = ring->written % ring->size;
+    uint32_t first = (length > ring->size - pos) ? ring->size - pos : length;
+
+    memcpy(&ring->buffer[pos], data, first);
+    memcpy(ring->buffer, data + first, length - first);
+    ring->written += length;
+}
+
+// Sink keeping messages in the CTP_LogRing passed as user
+void ctp_log_ring(void *user, CTP_LogLevel level, const char *message, size_t length) {
+    CTP_LogRing *ring = user;
+
+    (void)level;
+
+    ctp_log_ring_put(ring, message, length);
+    ctp_log_ring_put(ring, "\n", 1);
+}
+
+// Copy the buffered messages, oldest first, into out as a NUL terminated
+// string. Returns the number of characters copied, nothing fits in size 0.
+uint32_t ctp_log_ring_read(const CTP_LogRing *ring, char *out, uint32_t size) {
+    if (size == 0) {
+        return 0;
+    }
+
+    uint64_t available = (ring->written < ring->size) ? ring->written : ring->size;
+    uint32_t n = (available < size - 1) ? available : size - 1;
+    uint64_t start = ring->written - n;
+
+    for (uint32_t i = 0; i < n; i++) {
+        out[i] = ring->buffer[(start + i) % ring->size];
+    }
+    out[n] = '\0';
+
+    return n;
+}
@@ -0,0 +1,85 @@
+#ifndef CTP_LOG_H
+#define CTP_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Log levels, a message is kept when its level is at most CTP_LOG_LEVEL
+typedef enum {
+    CTP_LOG_LEVEL_NONE,
+    CTP_LOG_LEVEL_ERROR,
+    CTP_LOG_LEVEL_WARN,
+    CTP_LOG_LEVEL_INFO,
+    CTP_LOG_LEVEL_DEBUG,
+} CTP_LogLevel;
+
+// Messages above CTP_LOG_LEVEL are stripped at compile time, arguments and
+// formatting included. Release builds (NDEBUG) keep errors only, build with
+// -DCTP_LOG_LEVEL=CTP_LOG_LEVEL_NONE to strip everything.
+#ifndef CTP_LOG_LEVEL
+#ifdef NDEBUG
+#define CTP_LOG_LEVEL CTP_LOG_LEVEL_ERROR
+#else
+#define CTP_LOG_LEVEL CTP_LOG_LEVEL_INFO
+#endif
+#endif
+
+// Longest message passed to a sink, longer ones are truncated
+#ifndef CTP_LOG_LINE_MAX
+#define CTP_LOG_LINE_MAX 256
+#endif
+
+#define CTP_LOG_ENABLED(level) ((level) <= CTP_LOG_LEVEL)
+
+#define CTP_LOG(level, ...) \
+    do { \
+        if (CTP_LOG_ENABLED(level)) { \
+            ctp_log_write(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define CTP_LOG_ERROR(...) CTP_LOG(CTP_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define CTP_LOG_WARN(...) CTP_LOG(CTP_LOG_LEVEL_WARN, __VA_ARGS__)
+#define CTP_LOG_INFO(...) CTP_LOG(CTP_LOG_LEVEL_INFO, __VA_ARGS__)
+#define CTP_LOG_DEBUG(...) CTP_LOG(CTP_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+// Hex dump of length bytes, one message per line
+#define CTP_LOG_HEX(level, prefix, data, length) \
+    do { \
+        if (CTP_LOG_ENABLED(level)) { \
+            ctp_log_hex(level, prefix, data, length); \
+        } \
+    } while (0)
+
+// Receives every formatted message, without a trailing newline. Called on the
+// logging thread, a sink shared by several threads must do its own locking.
+typedef void (*CTP_LogSink)(void *user, CTP_LogLevel level, const char *message, size_t length);
+
+// Keeps the latest messages in memory, for targets without a console or for
+// reading back after a fault. Messages are stored newline terminated, the
+// oldest bytes are overwritten when the buffer is full.
+typedef struct {
+    char *buffer;
+    uint32_t size;
+    uint64_t written;                   // Total bytes ever written
+} CTP_LogRing;
+
+void ctp_log_set_sink(CTP_LogSink sink, void *user);
+void ctp_log_write(CTP_LogLevel level, const char *format, ...)
+#if defined(__GNUC__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+void ctp_log_hex(CTP_LogLevel level, const char *prefix, const uint8_t *data, uint32_t length);
+const char *ctp_log_level_name(CTP_LogLevel level);
+
+// Sinks, stderr is the default
+void ctp_log_stderr(void *user, CTP_LogLevel level, const char *message, size_t length);
+void ctp_log_syslog(void *user, CTP_LogLevel level, const char *message, size_t length);
+
+void ctp_log_ring_init(CTP_LogRing *ring, char *buffer, uint32_t size);
+void ctp_log_ring(void *user, CTP_LogLevel level, const char *message, size_t length);
+uint32_t ctp_log_ring_read(const CTP_LogRing *ring, char *out, uint32_t size);
+
+#endif
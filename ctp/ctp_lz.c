@@ -0,0 +1,370 @@
+#include <string.h>
+
+#include "ctp.h"
+#include "ctp_lz.h"
+
+#define CTP_LZ_WINDOW_MASK (CTP_LZ_WINDOW_SIZE - 1)
+#define CTP_LZ_RUN 15                   // Nibble value saying more length bytes follow
+
+
+static inline uint32_t ctp_lz_read32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t ctp_lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - CTP_LZ_HASH_BITS);
+}
+
+// Append a length that didn't fit its nibble, in bytes of 255 and a last smaller one
+static uint32_t ctp_lz_put_length(uint8_t *out, uint32_t o, uint32_t length) {
+    for (length -= CTP_LZ_RUN; length >= 255; length -= 255) {
+        out[o++] = 255;
+    }
+    out[o++] = (uint8_t)length;
+    return o;
+}
+
+// Append literals followed by a match, a match_length of 0 ends the stream.
+// Returns the new output position, 0 when out is too small.
+static uint32_t ctp_lz_put_sequence(uint8_t *out, uint32_t o, uint32_t out_size, const uint8_t *literals,
+                                    uint32_t literal_length, uint32_t offset, uint32_t match_length) {
+    uint32_t match_code = (match_length > 0) ? match_length - CTP_LZ_MIN_MATCH : 0;
+
+    // Token, length bytes, literals, offset
+    if (o + 1 + literal_length / 255 + 1 + literal_length + 2 + match_code / 255 + 1 > out_size) {
+        return 0;
+    }
+
+    uint32_t token = o++;
+    out[token] = (uint8_t)(((literal_length < CTP_LZ_RUN) ? literal_length : CTP_LZ_RUN) << 4);
+    if (literal_length >= CTP_LZ_RUN) {
+        o = ctp_lz_put_length(out, o, literal_length);
+    }
+    memcpy(&out[o], literals, literal_length);
+    o += literal_length;
+
+    if (match_length == 0) {
+        return o;
+    }
+
+    out[token] |= (match_code < CTP_LZ_RUN) ? match_code : CTP_LZ_RUN;
+    out[o++] = (uint8_t)offset;
+    out[o++] = (uint8_t)(offset >> 8);
+    if (match_code >= CTP_LZ_RUN) {
+        o = ctp_lz_put_length(out, o, match_code);
+    }
+    return o;
+}
+
+// Compress length bytes into out, which should hold CTP_LZ_BOUND(length)
+// bytes. Greedy matching with a single hash table probe, fast rather than
+// tight. Returns the compressed length, 0 when out is too small.
+uint32_t ctp_lz_compress(const uint8_t *data, uint32_t length, uint8_t *out, uint32_t out_size) {
+    uint32_t table[CTP_LZ_HASH_SIZE];   // Position + 1 of the last occurrence, 0 for none
+    uint32_t pos = 0;
+    uint32_t anchor = 0;
+    uint32_t o = CTP_LZ_HEADER_SIZE;
+
+    if (out_size < CTP_LZ_HEADER_SIZE) {
+        return 0;
+    }
+
+    memset(table, 0, sizeof(table));
+    out[0] = (uint8_t)(length >> 24);
+    out[1] = (uint8_t)(length >> 16);
+    out[2] = (uint8_t)(length >> 8);
+    out[3] = (uint8_t)length;
+
+    while (pos + CTP_LZ_MIN_MATCH <= length) {
+        uint32_t sequence = ctp_lz_read32(&data[pos]);
+        uint32_t h = ctp_lz_hash(sequence);
+        uint32_t candidate = table[h];
+
+        table[h] = pos + 1;
+
+        if (candidate == 0 || pos - (candidate - 1) > CTP_LZ_WINDOW_SIZE ||
+            ctp_lz_read32(&data[candidate - 1]) != sequence) {
+            pos++;
+            continue;
+        }
+
+        uint32_t match = candidate - 1;
+        uint32_t match_length = CTP_LZ_MIN_MATCH;
+
+        while (pos + match_length < length && data[match + match_length] == data[pos + match_length]) {
+            match_length++;
+        }
+
+        o = ctp_lz_put_sequence(out, o, out_size, &data[anchor], pos - anchor, pos - match, match_length);
+        if (o == 0) {
+            return 0;
+        }
+
+        pos += match_length;
+        anchor = pos;
+    }
+
+    // Whatever is left after the last match goes out as literals
+    if (anchor < length) {
+        o = ctp_lz_put_sequence(out, o, out_size, &data[anchor], length - anchor, 0, 0);
+    }
+
+    return o;
+}
+
+void ctp_lz_decoder_init(CTP_LzDecoder *dec, uint8_t *buffer, uint32_t buffer_size) {
+    dec->state = CTP_LZ_HEADER;
+    dec->length = 0;
+    dec->produced = 0;
+    dec->flushed = 0;
+    dec->consumed = 0;
+    dec->literal_length = 0;
+    dec->match_length = 0;
+    dec->offset = 0;
+    dec->count = 0;
+    dec->buffer = buffer;
+    dec->buffer_size = buffer_size;
+    dec->sink = NULL;
+    dec->sink_user = NULL;
+}
+
+void ctp_lz_decoder_init_sink(CTP_LzDecoder *dec, CTP_Sink sink, void *user) {
+    ctp_lz_decoder_init(dec, NULL, UINT32_MAX);
+    dec->sink = sink;
+    dec->sink_user = user;
+}
+
+static bool ctp_lz_fail(CTP_LzDecoder *dec) {
+    dec->state = CTP_LZ_ERROR;
+    return false;
+}
+
+// Hand what was decoded since the last flush to the buffer or sink. The
+// window is flushed whenever it wraps, so the data is never split.
+static bool ctp_lz_flush(CTP_LzDecoder *dec) {
+    uint32_t n = dec->produced - dec->flushed;
+    const uint8_t *src = &dec->window[dec->flushed & CTP_LZ_WINDOW_MASK];
+
+    if (n == 0) {
+        return true;
+    }
+
+    if (dec->sink != NULL) {
+        if (!dec->sink(dec->sink_user, dec->flushed, src, n)) {
+            return false;
+        }
+    }
+    else {
+        memcpy(&dec->buffer[dec->flushed], src, n);
+    }
+    dec->flushed += n;
+    return true;
+}
+
+static inline bool ctp_lz_put(CTP_LzDecoder *dec, uint8_t byte) {
+    dec->window[dec->produced++ & CTP_LZ_WINDOW_MASK] = byte;
+
+    return (dec->produced & CTP_LZ_WINDOW_MASK) != 0 || ctp_lz_flush(dec);
+}
+
+// After the literals either the stream is complete or a match follows
+static void ctp_lz_literals_done(CTP_LzDecoder *dec) {
+    dec->offset = 0;
+    dec->count = 0;
+    dec->state = (dec->produced == dec->length) ? CTP_LZ_DONE : CTP_LZ_OFFSET;
+}
+
+static bool ctp_lz_copy_match(CTP_LzDecoder *dec) {
+    if (dec->match_length > dec->length - dec->produced) {
+        return ctp_lz_fail(dec);
+    }
+
+    for (uint32_t i = 0; i < dec->match_length; i++) {
+        if (!ctp_lz_put(dec, dec->window[(dec->produced - dec->offset) & CTP_LZ_WINDOW_MASK])) {
+            return ctp_lz_fail(dec);
+        }
+    }
+
+    dec->state = (dec->produced == dec->length) ? CTP_LZ_DONE : CTP_LZ_TOKEN;
+    return true;
+}
+
+// Decode the next length bytes of a compressed stream. Returns false on
+// corrupt data, data past the end of the stream, or when the buffer is too
+// small or the sink aborts. The stream is complete once the state is
+// CTP_LZ_DONE.
+bool ctp_lz_decode(CTP_LzDecoder *dec, const uint8_t *data, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        uint8_t byte = data[i];
+
+        switch (dec->state) {
+            case CTP_LZ_HEADER:
+                dec->length = (dec->length << 8) | byte;
+                if (++dec->count < CTP_LZ_HEADER_SIZE) {
+                    break;
+                }
+                if (dec->sink == NULL && dec->length > dec->buffer_size) {
+                    return ctp_lz_fail(dec);
+                }
+                dec->state = (dec->length > 0) ? CTP_LZ_TOKEN : CTP_LZ_DONE;
+                break;
+
+            case CTP_LZ_TOKEN:
+                dec->literal_length = byte >> 4;
+                dec->match_length = (byte & 0x0F) + CTP_LZ_MIN_MATCH;
+                if (dec->literal_length == CTP_LZ_RUN) {
+                    dec->state = CTP_LZ_LITERAL_LENGTH;
+                }
+                else if (dec->literal_length > 0) {
+                    dec->state = CTP_LZ_LITERALS;
+                }
+                else {
+                    ctp_lz_literals_done(dec);
+                }
+                break;
+
+            case CTP_LZ_LITERAL_LENGTH:
+                dec->literal_length += byte;
+                if (byte != 255) {
+                    dec->state = CTP_LZ_LITERALS;
+                }
+                break;
+
+            case CTP_LZ_LITERALS:
+                if (dec->produced == dec->length) {
+                    return ctp_lz_fail(dec);
+                }
+                if (!ctp_lz_put(dec, byte)) {
+                    return ctp_lz_fail(dec);
+                }
+                if (--dec->literal_length == 0) {
+                    ctp_lz_literals_done(dec);
+                }
+                break;
+
+            case CTP_LZ_OFFSET:
+                dec->offset |= (uint32_t)byte << (8 * dec->count);
+                if (++dec->count < 2) {
+                    break;
+                }
+                if (dec->offset == 0 || dec->offset > dec->produced || dec->offset > CTP_LZ_WINDOW_SIZE) {
+                    return ctp_lz_fail(dec);
+                }
+                if (dec->match_length == CTP_LZ_RUN + CTP_LZ_MIN_MATCH) {
+                    dec->state = CTP_LZ_MATCH_LENGTH;
+                }
+                else if (!ctp_lz_copy_match(dec)) {
+                    return false;
+                }
+                break;
+
+            case CTP_LZ_MATCH_LENGTH:
+                dec->match_length += byte;
+                if (byte != 255 && !ctp_lz_copy_match(dec)) {
+                    return false;
+                }
+                break;
+
+            default:
+                // Nothing may follow the end of the stream
+                return ctp_lz_fail(dec);
+        }
+    }
+
+    dec->consumed += length;
+
+    if (!ctp_lz_flush(dec)) {
+        return ctp_lz_fail(dec);
+    }
+    return true;
+}
+
+// CTP_Sink decoding what a receiver hands it, user is the CTP_LzDecoder.
+// Pieces have to come in order, so retransmission and streaming decompression
+// don't go together.
+bool ctp_lz_sink(void *user, uint32_t offset, const uint8_t *data, uint32_t length) {
+    CTP_LzDecoder *dec = user;
+
+    if (offset != dec->consumed) {
+        return ctp_lz_fail(dec);
+    }
+
+    return ctp_lz_decode(dec, data, length);
+}
+
+// Decompress a complete stream into out. Returns the decompressed length, or
+// -1 if the stream is corrupt, truncated or doesn't fit out.
+int32_t ctp_lz_decompress(const uint8_t *data, uint32_t length, uint8_t *out, uint32_t out_size) {
+    CTP_LzDecoder dec;
+
+    ctp_lz_decoder_init(&dec, out, out_size);
+
+    if (!ctp_lz_decode(&dec, data, length) || dec.state != CTP_LZ_DONE) {
+        return -1;
+    }
+
+    return dec.length;
+}
+
+// Compress data into work, which should hold CTP_LZ_BOUND(length) bytes, and
+// send it as a single extended sequence with CTP_EXT_FLAG_LZ. Data that
+// doesn't get smaller goes out as it is. Returns length, or 0 if the receiver
+// aborts or stops answering.
+uint32_t ctp_send_compressed(CTP_Context *ctx, uint32_t id, const uint8_t *data, uint32_t length,
+                             uint8_t *work, uint32_t work_size, bool fd, uint8_t flags) {
+    uint32_t compressed_length = ctp_lz_compress(data, length, work, work_size);
+
+    if (compressed_length == 0 || compressed_length >= length) {
+        return ctp_send_extended(ctx, id, data, length, fd, flags & ~CTP_EXT_FLAG_LZ);
+    }
+
+    if (ctp_send_extended(ctx, id, work, compressed_length, fd, flags | CTP_EXT_FLAG_LZ) != compressed_length) {
+        return 0;
+    }
+
+    return length;
+}
+
+typedef struct {
+    CTP_Receiver rx;
+    CTP_LzDecoder dec;
+    uint8_t *buffer;
+    uint32_t buffer_size;
+} CTP_LzReceiver;
+
+// Sequences without CTP_EXT_FLAG_LZ are stored as they are
+static bool ctp_lz_receive_sink(void *user, uint32_t offset, const uint8_t *data, uint32_t length) {
+    CTP_LzReceiver *lz = user;
+
+    if (lz->rx.flags & CTP_EXT_FLAG_LZ) {
+        return ctp_lz_sink(&lz->dec, offset, data, length);
+    }
+
+    if (length > lz->buffer_size || offset > lz->buffer_size - length) {
+        return false;
+    }
+    memcpy(&lz->buffer[offset], data, length);
+    return true;
+}
+
+// Receive one sequence into buffer, decompressing it on the fly if the sender
+// compressed it. Returns the decompressed length, or -1 when the sequence
+// fails, doesn't fit buffer or ctx->timeouts expire. Needs the frames in order,
+// with retransmission enabled receive with ctp_receive_seq() and call
+// ctp_lz_decompress() instead.
+int32_t ctp_receive_compressed(CTP_Context *ctx, uint8_t *buffer, uint32_t buffer_size, bool fd) {
+    CTP_LzReceiver lz;
+
+    lz.buffer = buffer;
+    lz.buffer_size = buffer_size;
+    ctp_lz_decoder_init(&lz.dec, buffer, buffer_size);
+    ctp_rx_init_sink(&lz.rx, ctx, ctp_lz_receive_sink, &lz, fd);
+
+    int32_t length = ctp_receive_rx(ctx, &lz.rx);
+
+    if (length < 0 || !(lz.rx.flags & CTP_EXT_FLAG_LZ)) {
+        return length;
+    }
+
+    return (lz.dec.state == CTP_LZ_DONE) ? (int32_t)lz.dec.length : -1;
+}
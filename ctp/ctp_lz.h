@@ -0,0 +1,77 @@
+#ifndef CTP_LZ_H
+#define CTP_LZ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ctp.h"
+
+// Matches reach at most this far back and the decoder keeps as much history,
+// override at compile time to trade decoder memory for compression. Must be a
+// power of two, at most 32768.
+#ifndef CTP_LZ_WINDOW_SIZE
+#define CTP_LZ_WINDOW_SIZE 4096
+#endif
+
+// Compressor hash table entries, 2^CTP_LZ_HASH_BITS. The table lives on the stack.
+#ifndef CTP_LZ_HASH_BITS
+#define CTP_LZ_HASH_BITS 12
+#endif
+#define CTP_LZ_HASH_SIZE (1u << CTP_LZ_HASH_BITS)
+
+// A compressed stream starts with the uncompressed length, 32 bit big endian,
+// followed by LZ4 style sequences: a token with the literal count in the high
+// and the match length - CTP_LZ_MIN_MATCH in the low nibble, 15 meaning more
+// length bytes follow, the literals, a 16 bit little endian offset and the
+// extra match length bytes. The stream ends once the length is reached.
+#define CTP_LZ_HEADER_SIZE 4
+#define CTP_LZ_MIN_MATCH 4
+
+// Largest compressed size of length bytes
+#define CTP_LZ_BOUND(length) (CTP_LZ_HEADER_SIZE + (length) + (length) / 255 + 5)
+
+typedef enum {
+    CTP_LZ_HEADER,
+    CTP_LZ_TOKEN,
+    CTP_LZ_LITERAL_LENGTH,
+    CTP_LZ_LITERALS,
+    CTP_LZ_OFFSET,
+    CTP_LZ_MATCH_LENGTH,
+    CTP_LZ_DONE,
+    CTP_LZ_ERROR,
+} CTP_LzState;
+
+// Streaming decompressor. Compressed data goes in in pieces of any size, the
+// decompressed data comes out into a buffer or a sink as it is decoded. Only
+// the last CTP_LZ_WINDOW_SIZE bytes are kept, so a sink can take transfers of
+// any length.
+typedef struct {
+    CTP_LzState state;
+    uint32_t length;                    // Uncompressed length, valid past the header
+    uint32_t produced;                  // Bytes decoded so far
+    uint32_t flushed;                   // Bytes handed to the buffer or sink
+    uint32_t consumed;                  // Compressed bytes decoded so far
+    uint32_t literal_length;
+    uint32_t match_length;
+    uint32_t offset;
+    uint8_t count;                      // Header or offset bytes collected
+    uint8_t *buffer;
+    uint32_t buffer_size;
+    CTP_Sink sink;                      // Takes the data instead of buffer when set
+    void *sink_user;
+    uint8_t window[CTP_LZ_WINDOW_SIZE];
+} CTP_LzDecoder;
+
+uint32_t ctp_lz_compress(const uint8_t *data, uint32_t length, uint8_t *out, uint32_t out_size);
+int32_t ctp_lz_decompress(const uint8_t *data, uint32_t length, uint8_t *out, uint32_t out_size);
+
+void ctp_lz_decoder_init(CTP_LzDecoder *dec, uint8_t *buffer, uint32_t buffer_size);
+void ctp_lz_decoder_init_sink(CTP_LzDecoder *dec, CTP_Sink sink, void *user);
+bool ctp_lz_decode(CTP_LzDecoder *dec, const uint8_t *data, uint32_t length);
+bool ctp_lz_sink(void *user, uint32_t offset, const uint8_t *data, uint32_t length);
+
+uint32_t ctp_send_compressed(CTP_Context *ctx, uint32_t id, const uint8_t *data, uint32_t length,
+                             uint8_t *work, uint32_t work_size, bool fd, uint8_t flags);
+int32_t ctp_receive_compressed(CTP_Context *ctx, uint8_t *buffer, uint32_t buffer_size, bool fd);
+
+#endif
@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ctp_pool.h"
+
+
+// Sets up worker_count workers reassembling the frames of channel_count
+// channels. Session tables and rings are allocated here, call
+// ctp_pool_destroy() to free them. Every worker answers flow control for the
+// sessions of channel i through a copy of channels[i], taken here, so later
+// changes to the channel's configuration don't reach the workers. All workers
+// and the channel's own thread send on the same driver handle, its send must
+// be thread safe.
+bool ctp_pool_init(CTP_Pool *pool, CTP_Context **channels, uint32_t channel_count, uint32_t worker_count,
+                   bool fd, CTP_PoolHandler handler, void *user) {
+    if (channel_count == 0 || channel_count > CTP_POOL_MAX_CHANNELS ||
+        worker_count == 0 || worker_count > CTP_POOL_MAX_WORKERS) {
+        return false;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+    memcpy(pool->channels, channels, channel_count * sizeof(channels[0]));
+    pool->channel_count = channel_count;
+    pool->worker_count = worker_count;
+    pool->handler = handler;
+    pool->user = user;
+    pool->fd = fd;
+    atomic_init(&pool->running, false);
+
+    for (uint32_t w = 0; w < worker_count; w++) {
+        CTP_PoolWorker *worker = &pool->workers[w];
+
+        worker->pool = pool;
+        worker->table = malloc(sizeof(CTP_RxTable));
+        worker->slots = malloc(channel_count * CTP_POOL_RING_SIZE * sizeof(CTP_CanFrame));
+
+        if (worker->table == NULL || worker->slots == NULL) {
+            ctp_pool_destroy(pool);
+            return false;
+        }
+
+        ctp_rx_table_init(worker->table, NULL, fd);
+
+        for (uint32_t c = 0; c < channel_count; c++) {
+            ctp_ring_init(&worker->rings[c], &worker->slots[c * CTP_POOL_RING_SIZE], CTP_POOL_RING_SIZE);
+
+            // Frames read ahead by the channel's thread stay with the channel
+            memcpy(&worker->contexts[c], channels[c], sizeof(CTP_Context));
+            worker->contexts[c].rx_batch_count = 0;
+            worker->contexts[c].rx_batch_pos = 0;
+            ctp_stats_reset(&worker->contexts[c]);
+        }
+
+        atomic_init(&worker->dropped, 0);
+        atomic_init(&worker->frames, 0);
+        atomic_init(&worker->completed, 0);
+        atomic_init(&worker->errors, 0);
+    }
+
+    return true;
+}
+
+void ctp_pool_destroy(CTP_Pool *pool) {
+    for (uint32_t w = 0; w < pool->worker_count; w++) {
+        free(pool->workers[w].table);
+        free(pool->workers[w].slots);
+        pool->workers[w].table = NULL;
+        pool->workers[w].slots = NULL;
+    }
+}
+
+uint32_t ctp_pool_worker_of(const CTP_Pool *pool, uint32_t channel, uint32_t id) {
+    uint32_t hash = (id ^ (channel * 0x9E3779B9u)) * 2654435761u;
+
+    // Map the hash onto the workers without a division
+    return (uint32_t)(((uint64_t)hash * pool->worker_count) >> 32);
+}
+
+static void ctp_pool_count(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+// Queue frames read on channel to the workers owning their CAN IDs. Must only
+// be called from that channel's bus thread. A frame whose worker is full is
+// dropped and counted. Returns the number of frames queued.
+uint32_t ctp_pool_dispatch(CTP_Pool *pool, uint32_t channel, const CTP_CanFrame *frames, uint32_t count) {
+    uint32_t queued = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        CTP_PoolWorker *worker = &pool->workers[ctp_pool_worker_of(pool, channel, frames[i].id)];
+
+        if (ctp_ring_push(&worker->rings[channel], &frames[i])) {
+            queued++;
+        }
+        else {
+            ctp_pool_count(&worker->dropped, 1);
+        }
+    }
+
+    return queued;
+}
+
+// Read everything the channel's driver has ready and dispatch it. Returns the
+// number of frames read.
+uint32_t ctp_pool_pump(CTP_Pool *pool, uint32_t channel) {
+    CTP_Context *ctx = pool->channels[channel];
+    CTP_CanFrame frames[CTP_RX_BATCH_SIZE];
+    uint32_t total = 0;
+    uint32_t count;
+
+    do {
+        for (count = 0; count < CTP_RX_BATCH_SIZE && ctp_read_frame(ctx, &frames[count]); count++) {
+        }
+
+        ctp_pool_dispatch(pool, channel, frames, count);
+        total += count;
+    } while (count == CTP_RX_BATCH_SIZE);
+
+    return total;
+}
+
+static void ctp_pool_feed(CTP_Pool *pool, CTP_PoolWorker *worker, uint32_t channel, const CTP_CanFrame *frame) {
+    CTP_Receiver *session;
+
+    switch (ctp_rx_table_feed_frame(worker->table, &worker->contexts[channel], channel, frame, &session)) {
+        case CTP_RX_COMPLETE:
+            ctp_pool_count(&worker->completed, 1);
+            if (pool->handler != NULL) {
+                pool->handler(pool->user, channel, session);
+            }
+            break;
+        case CTP_RX_ERROR:
+            ctp_pool_count(&worker->errors, 1);
+            break;
+        default:
+            break;
+    }
+}
+
+static void *ctp_pool_worker_main(void *arg) {
+    CTP_PoolWorker *worker = arg;
+    CTP_Pool *pool = worker->pool;
+    CTP_CanFrame frames[CTP_RX_BATCH_SIZE];
+    const struct timespec idle = {0, CTP_POOL_IDLE_US * 1000};
+    uint32_t since_expire = 0;
+
+    while (atomic_load_explicit(&pool->running, memory_order_relaxed)) {
+        uint32_t total = 0;
+
+        for (uint32_t c = 0; c < pool->channel_count; c++) {
+            uint32_t n = ctp_ring_pop_batch(&worker->rings[c], frames, CTP_RX_BATCH_SIZE);
+
+            for (uint32_t i = 0; i < n; i++) {
+                ctp_pool_feed(pool, worker, c, &frames[i]);
+            }
+            total += n;
+        }
+
+        if (total > 0) {
+            ctp_pool_count(&worker->frames, total);
+            since_expire += total;
+        }
+
+        // Drop stalled sessions whenever the queues run dry, and regularly
+        // under sustained load, so they don't keep the table full
+        if (total == 0 || since_expire >= CTP_POOL_EXPIRE_FRAMES) {
+            ctp_pool_count(&worker->errors, ctp_rx_table_expire(worker->table));
+            since_expire = 0;
+        }
+
+        if (total == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+bool ctp_pool_start(CTP_Pool *pool) {
+    atomic_store(&pool->running, true);
+
+    for (uint32_t w = 0; w < pool->worker_count; w++) {
+        if (pthread_create(&pool->workers[w].thread, NULL, ctp_pool_worker_main, &pool->workers[w]) != 0) {
+            // Stop the workers already running
+            atomic_store(&pool->running, false);
+            while (w-- > 0) {
+                pthread_join(pool->workers[w].thread, NULL);
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Stop and join the workers, frames still queued stay in the rings
+void ctp_pool_stop(CTP_Pool *pool) {
+    if (!atomic_exchange(&pool->running, false)) {
+        return;
+    }
+
+    for (uint32_t w = 0; w < pool->worker_count; w++) {
+        pthread_join(pool->workers[w].thread, NULL);
+    }
+}
+
+// Counters of one worker, safe to call from any thread while the pool runs
+void ctp_pool_stats(CTP_Pool *pool, uint32_t worker, CTP_PoolStats *stats) {
+    CTP_PoolWorker *w = &pool->workers[worker];
+
+    stats->queue_depth = 0;
+    for (uint32_t c = 0; c < pool->channel_count; c++) {
+        // Tail first, the head can only have moved further since
+        uint32_t tail = atomic_load_explicit(&w->rings[c].tail, memory_order_acquire);
+        stats->queue_depth += atomic_load_explicit(&w->rings[c].head, memory_order_acquire) - tail;
+    }
+
+    stats->frames = atomic_load_explicit(&w->frames, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&w->dropped, memory_order_relaxed);
+    stats->completed = atomic_load_explicit(&w->completed, memory_order_relaxed);
+    stats->errors = atomic_load_explicit(&w->errors, memory_order_relaxed);
+}
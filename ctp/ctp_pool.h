@@ -0,0 +1,96 @@
+#ifndef CTP_POOL_H
+#define CTP_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "ctp.h"
+#include "ctp_ring.h"
+
+// Pool sizing, override at compile time. CTP_POOL_RING_SIZE is the number of
+// frames queued per channel and worker and must be a power of two.
+#ifndef CTP_POOL_MAX_WORKERS
+#define CTP_POOL_MAX_WORKERS 16
+#endif
+
+#ifndef CTP_POOL_MAX_CHANNELS
+#define CTP_POOL_MAX_CHANNELS 8
+#endif
+
+#ifndef CTP_POOL_RING_SIZE
+#define CTP_POOL_RING_SIZE 1024
+#endif
+
+// How long an idle worker sleeps before looking at its queues again
+#ifndef CTP_POOL_IDLE_US
+#define CTP_POOL_IDLE_US 100
+#endif
+
+// Frames a busy worker feeds between two looks for stalled sessions, idle
+// workers look every time they run out of frames
+#ifndef CTP_POOL_EXPIRE_FRAMES
+#define CTP_POOL_EXPIRE_FRAMES 256
+#endif
+
+// Called on a worker thread for every completed sequence. The session and its
+// buffer are only valid during the call.
+typedef void (*CTP_PoolHandler)(void *user, uint32_t channel, const CTP_Receiver *session);
+
+typedef struct CTP_Pool CTP_Pool;
+
+// A worker owns the sessions of every CAN ID hashed to it, on all channels.
+// Each channel feeds it through its own SPSC ring, so channels never contend.
+// Flow control goes out through the worker's own copy of each channel's
+// context, which also counts the worker's frames.
+typedef struct {
+    CTP_Ring rings[CTP_POOL_MAX_CHANNELS];
+    CTP_Context contexts[CTP_POOL_MAX_CHANNELS];
+    CTP_CanFrame *slots;
+    CTP_RxTable *table;
+    CTP_Pool *pool;
+    pthread_t thread;
+
+    // Written by the channels' bus threads
+    _Atomic uint64_t dropped;           // Frames lost to a full ring
+
+    // Written by the worker
+    _Atomic uint64_t frames;
+    _Atomic uint64_t completed;
+    _Atomic uint64_t errors;            // Failed, expired or unplaceable sequences
+} CTP_PoolWorker;
+
+struct CTP_Pool {
+    CTP_Context *channels[CTP_POOL_MAX_CHANNELS];
+    uint32_t channel_count;
+    CTP_PoolWorker workers[CTP_POOL_MAX_WORKERS];
+    uint32_t worker_count;
+    CTP_PoolHandler handler;
+    void *user;
+    bool fd;
+    atomic_bool running;
+};
+
+typedef struct {
+    uint32_t queue_depth;               // Frames waiting in the worker's rings
+    uint64_t frames;
+    uint64_t dropped;
+    uint64_t completed;
+    uint64_t errors;
+} CTP_PoolStats;
+
+bool ctp_pool_init(CTP_Pool *pool, CTP_Context **channels, uint32_t channel_count, uint32_t worker_count,
+                   bool fd, CTP_PoolHandler handler, void *user);
+bool ctp_pool_start(CTP_Pool *pool);
+void ctp_pool_stop(CTP_Pool *pool);
+void ctp_pool_destroy(CTP_Pool *pool);
+
+// Bus thread side, one thread per channel
+uint32_t ctp_pool_worker_of(const CTP_Pool *pool, uint32_t channel, uint32_t id);
+uint32_t ctp_pool_dispatch(CTP_Pool *pool, uint32_t channel, const CTP_CanFrame *frames, uint32_t count);
+uint32_t ctp_pool_pump(CTP_Pool *pool, uint32_t channel);
+
+void ctp_pool_stats(CTP_Pool *pool, uint32_t worker, CTP_PoolStats *stats);
+
+#endif
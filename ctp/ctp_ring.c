@@ -0,0 +1,180 @@
+#include <string.h>
+
+#include "ctp_ring.h"
+
+
+void ctp_ring_init(CTP_Ring *ring, CTP_CanFrame *slots, uint32_t count) {
+    ring->slots = slots;
+    ring->mask = count - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->tail_cache = 0;
+    ring->head_cache = 0;
+}
+
+// Free slots from the producer's point of view, refreshes the cached tail
+// only when the ring looks full
+static uint32_t ctp_ring_space(CTP_Ring *ring, uint32_t head) {
+    uint32_t size = ring->mask + 1;
+
+    if (head - ring->tail_cache == size) {
+        ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    }
+
+    return size - (head - ring->tail_cache);
+}
+
+// Frames ready from the consumer's point of view, refreshes the cached head
+// only when it can't cover the wanted number of frames
+static uint32_t ctp_ring_ready(CTP_Ring *ring, uint32_t tail, uint32_t want) {
+    if (ring->head_cache - tail < want) {
+        ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+    }
+
+    return ring->head_cache - tail;
+}
+
+bool ctp_ring_push(CTP_Ring *ring, const CTP_CanFrame *frame) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if (ctp_ring_space(ring, head) == 0) {
+        return false;
+    }
+
+    ring->slots[head & ring->mask] = *frame;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+// Move every frame the driver has ready into the ring, reading straight into
+// the free slots. Stops early when the ring is full, the frames left wait in
+// the driver's queue. Returns the number of frames moved.
+uint32_t ctp_ring_pump(CTP_Ring *ring, const CTP_Driver *driver, void *handle) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t start = head;
+    uint32_t space;
+
+    while ((space = ctp_ring_space(ring, head)) > 0) {
+        uint32_t pos = head & ring->mask;
+        uint32_t n;
+
+        // Don't run past the end of the slot array
+        if (space > ring->mask + 1 - pos) {
+            space = ring->mask + 1 - pos;
+        }
+
+        if (driver->receive_batch != NULL) {
+            n = driver->receive_batch(handle, &ring->slots[pos], space);
+        }
+        else {
+            CTP_CanFrame *slot = &ring->slots[pos];
+
+            slot->timestamp_us = 0;
+            n = driver->receive(handle, &slot->id, slot->data, &slot->len) ? 1 : 0;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        head += n;
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+    }
+
+    return head - start;
+}
+
+bool ctp_ring_pop(CTP_Ring *ring, CTP_CanFrame *frame) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (ctp_ring_ready(ring, tail, 1) == 0) {
+        return false;
+    }
+
+    *frame = ring->slots[tail & ring->mask];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+uint32_t ctp_ring_pop_batch(CTP_Ring *ring, CTP_CanFrame *frames, uint32_t count) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t ready = ctp_ring_ready(ring, tail, count);
+    uint32_t n = (ready < count) ? ready : count;
+
+    for (uint32_t i = 0; i < n; i++) {
+        frames[i] = ring->slots[(tail + i) & ring->mask];
+    }
+
+    // Hand all slots back to the producer at once
+    if (n > 0) {
+        atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    }
+
+    return n;
+}
+
+static bool ctp_ring_port_send(void *handle, uint32_t id, const uint8_t *data, uint8_t len) {
+    CTP_RingPort *port = handle;
+
+    return port->bus->send(port->bus_handle, id, data, len);
+}
+
+static bool ctp_ring_port_receive(void *handle, uint32_t *id, uint8_t *data, uint8_t *len) {
+    CTP_RingPort *port = handle;
+    CTP_CanFrame frame;
+
+    if (!ctp_ring_pop(port->ring, &frame)) {
+        return false;
+    }
+
+    *id = frame.id;
+    *len = frame.len;
+    memcpy(data, frame.data, frame.len);
+    return true;
+}
+
+static uint32_t ctp_ring_port_send_batch(void *handle, const CTP_CanFrame *frames, uint32_t count) {
+    CTP_RingPort *port = handle;
+
+    return port->bus->send_batch(port->bus_handle, frames, count);
+}
+
+static uint32_t ctp_ring_port_receive_batch(void *handle, CTP_CanFrame *frames, uint32_t count) {
+    CTP_RingPort *port = handle;
+
+    return ctp_ring_pop_batch(port->ring, frames, count);
+}
+
+static uint64_t ctp_ring_port_now_us(void *handle) {
+    CTP_RingPort *port = handle;
+
+    return port->bus->now_us(port->bus_handle);
+}
+
+static void ctp_ring_port_sleep_us(void *handle, uint32_t us) {
+    CTP_RingPort *port = handle;
+
+    port->bus->sleep_us(port->bus_handle, us);
+}
+
+static bool ctp_ring_port_set_filter(void *handle, const CTP_IdRange *ranges, uint32_t count) {
+    CTP_RingPort *port = handle;
+
+    return port->bus->set_filter(port->bus_handle, ranges, count);
+}
+
+void ctp_ring_port_init(CTP_RingPort *port, CTP_Ring *ring, const CTP_Driver *bus, void *bus_handle) {
+    port->ring = ring;
+    port->bus = bus;
+    port->bus_handle = bus_handle;
+
+    port->driver.send = ctp_ring_port_send;
+    port->driver.receive = ctp_ring_port_receive;
+    port->driver.receive_batch = ctp_ring_port_receive_batch;
+
+    // Only forward the hooks the bus driver has, CTP checks them for NULL
+    port->driver.send_batch = bus->send_batch ? ctp_ring_port_send_batch : NULL;
+    port->driver.now_us = bus->now_us ? ctp_ring_port_now_us : NULL;
+    port->driver.sleep_us = bus->sleep_us ? ctp_ring_port_sleep_us : NULL;
+    port->driver.set_filter = bus->set_filter ? ctp_ring_port_set_filter : NULL;
+}
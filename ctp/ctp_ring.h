@@ -0,0 +1,53 @@
+#ifndef CTP_RING_H
+#define CTP_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "ctp.h"
+
+#define CTP_RING_CACHE_LINE 64
+
+// Lock-free single-producer/single-consumer ring of CAN frames. The bus thread
+// fills it with ctp_ring_pump(), the protocol thread drains it through a
+// CTP_RingPort, so a slow protocol layer never stalls reading the hardware.
+// Each index lives on its own cache line next to a cached copy of the other
+// side's index, the two threads only touch each other's line when the cached
+// copy says the ring looks full or empty.
+typedef struct {
+    CTP_CanFrame *slots;                // Caller-provided, a power of two of them
+    uint32_t mask;
+
+    // Written by the producer only
+    _Alignas(CTP_RING_CACHE_LINE) _Atomic uint32_t head;
+    uint32_t tail_cache;
+
+    // Written by the consumer only
+    _Alignas(CTP_RING_CACHE_LINE) _Atomic uint32_t tail;
+    uint32_t head_cache;
+} CTP_Ring;
+
+// Protocol side of a ring. Receives come out of the ring, transmit, the clock
+// and sleeping go straight to the bus driver the ring is pumped from, so that
+// driver must allow sending from the protocol thread while the bus thread
+// receives. Pass &port->driver and the port to ctp_init().
+typedef struct {
+    CTP_Ring *ring;
+    const CTP_Driver *bus;
+    void *bus_handle;
+    CTP_Driver driver;                  // Offers the same optional hooks as bus
+} CTP_RingPort;
+
+void ctp_ring_init(CTP_Ring *ring, CTP_CanFrame *slots, uint32_t count);
+
+// Producer side
+bool ctp_ring_push(CTP_Ring *ring, const CTP_CanFrame *frame);
+uint32_t ctp_ring_pump(CTP_Ring *ring, const CTP_Driver *driver, void *handle);
+
+// Consumer side
+bool ctp_ring_pop(CTP_Ring *ring, CTP_CanFrame *frame);
+uint32_t ctp_ring_pop_batch(CTP_Ring *ring, CTP_CanFrame *frames, uint32_t count);
+void ctp_ring_port_init(CTP_RingPort *port, CTP_Ring *ring, const CTP_Driver *bus, void *bus_handle);
+
+#endif
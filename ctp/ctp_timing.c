@@ -0,0 +1,168 @@
+#include <string.h>
+
+#include "ctp.h"
+#include "ctp_timing.h"
+
+// CRC delimiter, ACK slot and delimiter, EOF and the interframe space
+#define CTP_TIMING_TAIL_BITS 13
+
+
+// Bits of a len byte frame, padded like the CTP pads it. Stuffing assumes the
+// worst case, a stuff bit after every 4 stuffable bits.
+CTP_FrameBits ctp_timing_frame_bits(const CTP_BusTiming *bus, uint8_t len) {
+    CTP_FrameBits bits;
+
+    // Classic frames can't be padded beyond 8 bytes
+    if (len < bus->min_length) {
+        len = (!bus->fd && bus->min_length > 8) ? 8 : bus->min_length;
+    }
+
+    if (!bus->fd) {
+        // SOF, arbitration, control, data and CRC are stuffed
+        uint32_t stuffed = (bus->extended_id ? 54 : 34) + 8 * len;
+
+        bits.nominal = stuffed + (stuffed - 1) / 4 + CTP_TIMING_TAIL_BITS;
+        bits.data = 0;
+        return bits;
+    }
+
+    uint32_t length = ctp_dlc_to_length(ctp_length_to_dlc(len));
+
+    // SOF up to BRS, the bit rate switches at its sample point
+    uint32_t arbitration = bus->extended_id ? 36 : 17;
+
+    // ESI, DLC and data continue the dynamic stuffing of the arbitration phase
+    uint32_t dynamic = 5 + 8 * length;
+    uint32_t arbitration_stuff = (arbitration - 1) / 4;
+    uint32_t dynamic_stuff = (arbitration + dynamic - 1) / 4 - arbitration_stuff;
+
+    // The stuff count and CRC get a fixed stuff bit ahead and after every 4 bits
+    uint32_t crc = 4 + ((length <= 16) ? 17 : 21);
+
+    bits.nominal = arbitration + arbitration_stuff + CTP_TIMING_TAIL_BITS;
+    bits.data = dynamic + dynamic_stuff + crc + 1 + crc / 4;
+
+    if (bus->data_bitrate == 0) {
+        bits.nominal += bits.data;
+        bits.data = 0;
+    }
+
+    return bits;
+}
+
+uint64_t ctp_timing_frame_ns(const CTP_BusTiming *bus, uint8_t len) {
+    CTP_FrameBits bits = ctp_timing_frame_bits(bus, len);
+    uint64_t ns = (uint64_t)bits.nominal * 1000000000u / bus->bitrate;
+
+    if (bits.data > 0) {
+        ns += (uint64_t)bits.data * 1000000000u / bus->data_bitrate;
+    }
+
+    return ns;
+}
+
+static uint64_t ctp_timing_add_frame(const CTP_BusTiming *bus, uint8_t len, CTP_TimingEstimate *estimate) {
+    CTP_FrameBits bits = ctp_timing_frame_bits(bus, len);
+    uint64_t ns = ctp_timing_frame_ns(bus, len);
+
+    estimate->bits += bits.nominal + bits.data;
+    estimate->busy_ns += ns;
+    return ns;
+}
+
+// Flow control frame sent back by the receiver, the sender waits for it
+static void ctp_timing_add_flow_control(const CTP_BusTiming *bus, CTP_TimingEstimate *estimate) {
+    estimate->time_ns += ctp_timing_add_frame(bus, CTP_FLOW_CONTROL_FRAME_LENGTH, estimate);
+    estimate->flow_control_frames++;
+}
+
+// One sequence as ctp_send_data_sequence() sends it. Inside a flow control
+// block a frame starts st_min after the previous one, or once it has left
+// the bus. Between blocks the sender waits for the receiver's next credits.
+static void ctp_timing_sequence(const CTP_BusTiming *bus, const CTP_FlowControl *fc, uint16_t length, CTP_TimingEstimate *estimate) {
+    uint32_t start_data_size = bus->fd ? CTP_FD_START_DATA_SIZE : CTP_START_DATA_SIZE;
+    uint32_t con_data_size = bus->fd ? CTP_FD_CONSECUTIVE_DATA_LENGTH : CTP_CONSECUTIVE_DATA_LENGTH;
+    uint32_t frame_count = ctp_sequence_frame_count(length, bus->fd);
+    bool flow_control = fc != NULL && fc->enabled;
+    uint32_t block_size = flow_control ? fc->block_size : 0;
+    uint64_t st_min_ns = flow_control ? (uint64_t)ctp_st_min_us(fc->st_min) * 1000 : 0;
+
+    estimate->sequences++;
+    estimate->frames += frame_count;
+
+    if (frame_count == 1) {
+        estimate->time_ns += ctp_timing_add_frame(bus, CTP_START_FRAME_HEADER_SIZE + length, estimate);
+    }
+    else {
+        uint32_t con_frames = frame_count - 2;
+        uint32_t end_data_size = length - start_data_size - con_frames * con_data_size;
+        uint32_t in_block = 0;
+
+        estimate->time_ns += ctp_timing_add_frame(bus, CTP_START_FRAME_HEADER_SIZE + start_data_size, estimate);
+        if (flow_control) {
+            ctp_timing_add_flow_control(bus, estimate);
+        }
+
+        for (uint32_t i = 0; i <= con_frames; i++) {
+            uint8_t len = (i < con_frames) ? CTP_CONSECUTIVE_FRAME_HEADER_SIZE + con_data_size
+                                           : CTP_END_FRAME_HEADER_SIZE + end_data_size;
+            uint64_t ns = ctp_timing_add_frame(bus, len, estimate);
+
+            // The receiver grants the next block once this one's CONSECUTIVE frames are in
+            bool block_done = block_size > 0 && i < con_frames && ++in_block == block_size;
+
+            if (block_done) {
+                in_block = 0;
+                estimate->time_ns += ns;
+                ctp_timing_add_flow_control(bus, estimate);
+            }
+            else if (i < con_frames) {
+                estimate->time_ns += (ns > st_min_ns) ? ns : st_min_ns;
+            }
+            else {
+                estimate->time_ns += ns;
+            }
+        }
+    }
+
+    // A retransmitting sender waits for the receiver to confirm the sequence
+    if (fc != NULL && fc->retransmit) {
+        ctp_timing_add_flow_control(bus, estimate);
+    }
+}
+
+// Estimate a ctp_send() of length bytes on a fault free bus, split into
+// sequences the same way. fc is the receiver's flow control configuration,
+// NULL without flow control. Time the receiver takes to answer and gaps
+// between frames from other nodes aren't included, so the transfer time is a
+// lower bound and the bus load an upper one.
+void ctp_timing_estimate(const CTP_BusTiming *bus, const CTP_FlowControl *fc, uint32_t length, CTP_TimingEstimate *estimate) {
+    uint32_t max_len = bus->fd ? CTP_FD_MAX_SEQUENCE_LENGTH : CTP_MAX_SEQUENCE_LENGTH;
+    CTP_TimingEstimate full;
+
+    memset(estimate, 0, sizeof(*estimate));
+    memset(&full, 0, sizeof(full));
+
+    // Full sequences are all alike, estimate one and scale it
+    uint32_t full_sequences = length / max_len;
+
+    if (full_sequences > 0) {
+        ctp_timing_sequence(bus, fc, max_len, &full);
+
+        estimate->sequences = full.sequences * full_sequences;
+        estimate->frames = full.frames * full_sequences;
+        estimate->flow_control_frames = full.flow_control_frames * full_sequences;
+        estimate->bits = full.bits * full_sequences;
+        estimate->busy_ns = full.busy_ns * full_sequences;
+        estimate->time_ns = full.time_ns * full_sequences;
+    }
+
+    if (length % max_len > 0) {
+        ctp_timing_sequence(bus, fc, length % max_len, estimate);
+    }
+
+    if (estimate->time_ns > 0) {
+        estimate->bus_load = (double)estimate->busy_ns / estimate->time_ns;
+        estimate->throughput = length * 1e9 / estimate->time_ns;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef CTP_TIMING_H
+#define CTP_TIMING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ctp.h"
+
+// Bus configuration a transfer is estimated for
+typedef struct {
+    uint32_t bitrate;                   // Nominal bit rate, bit/s
+    uint32_t data_bitrate;              // FD data phase bit rate, 0 without bit rate switching
+    bool fd;                            // CAN FD frames and CTP FD chunking
+    bool extended_id;                   // 29 bit identifiers
+    uint8_t min_length;                 // Frames are padded to at least this length, see CTP_Padding
+} CTP_BusTiming;
+
+// Bits of a frame on the wire, worst case bit stuffing and the interframe
+// space included. With bit rate switching the data phase runs at data_bitrate.
+typedef struct {
+    uint32_t nominal;
+    uint32_t data;
+} CTP_FrameBits;
+
+typedef struct {
+    uint32_t sequences;
+    uint32_t frames;                    // START, CONSECUTIVE and END frames
+    uint32_t flow_control_frames;       // Sent back by the receiver
+    uint64_t bits;                      // Wire bits of all frames
+    uint64_t busy_ns;                   // Time the frames occupy the bus
+    uint64_t time_ns;                   // Transfer time, separation times included
+    double bus_load;                    // Share of the transfer time the bus is busy
+    double throughput;                  // Payload bytes per second
+} CTP_TimingEstimate;
+
+CTP_FrameBits ctp_timing_frame_bits(const CTP_BusTiming *bus, uint8_t len);
+uint64_t ctp_timing_frame_ns(const CTP_BusTiming *bus, uint8_t len);
+void ctp_timing_estimate(const CTP_BusTiming *bus, const CTP_FlowControl *fc, uint32_t length, CTP_TimingEstimate *estimate);
+
+#endif
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+
+// Pin the level, so the test doesn't depend on NDEBUG
+#define CTP_LOG_LEVEL CTP_LOG_LEVEL_INFO
+#include "ctp_log.h"
+
+int evaluated = 0;
+
+// Side effect in a log argument, shows whether the call was compiled in
+int count_evaluation() {
+    return ++evaluated;
+}
+
+bool test_log_levels() {
+    char buffer[256];
+    char text[256];
+    CTP_LogRing ring;
+
+    ctp_log_ring_init(&ring, buffer, sizeof(buffer));
+    ctp_log_set_sink(ctp_log_ring, &ring);
+
+    CTP_LOG_ERROR("error %d", 1);
+    CTP_LOG_WARN("warn %s", "two");
+    CTP_LOG_INFO("info %d", count_evaluation());
+    CTP_LOG_DEBUG("debug %d", count_evaluation());
+
+    ctp_log_ring_read(&ring, text, sizeof(text));
+    assert(strcmp(text, "error 1\nwarn two\ninfo 1\n") == 0);
+    assert(evaluated == 1);
+    printf("SEQ: 1 Passed\n");
+
+    // No sink, nothing is formatted
+    ctp_log_set_sink(NULL, NULL);
+    CTP_LOG_ERROR("dropped");
+    ctp_log_ring_read(&ring, text, sizeof(text));
+    assert(strcmp(text, "error 1\nwarn two\ninfo 1\n") == 0);
+    printf("SEQ: 2 Passed\n");
+
+    ctp_log_set_sink(ctp_log_stderr, NULL);
+    return true;
+}
+
+bool test_log_ring() {
+    char buffer[16];
+    char text[32];
+    CTP_LogRing ring;
+    uint8_t data[20];
+    char hex[128];
+    char text_hex[128];
+
+    ctp_log_ring_init(&ring, buffer, sizeof(buffer));
+    ctp_log_set_sink(ctp_log_ring, &ring);
+
+    // Older messages are overwritten, the newest bytes stay
+    CTP_LOG_INFO("0123456789");
+    CTP_LOG_INFO("abcdefgh");
+    assert(ctp_log_ring_read(&ring, text, sizeof(text)) == 16);
+    assert(strcmp(text, "456789\nabcdefgh\n") == 0);
+    printf("SEQ: 1 Passed\n");
+
+    // Reading into a smaller buffer keeps the newest end
+    assert(ctp_log_ring_read(&ring, text, 6) == 5);
+    assert(strcmp(text, "efgh\n") == 0);
+
+    // Nothing is written to an empty buffer
+    text[0] = 'x';
+    assert(ctp_log_ring_read(&ring, text, 0) == 0 && text[0] == 'x');
+    printf("SEQ: 2 Passed\n");
+
+    // Hex dumps go out 16 bytes per message, disabled levels not at all
+    for (int i = 0; i < sizeof(data); i++) {
+        data[i] = 0xA0 + i;
+    }
+    ctp_log_ring_init(&ring, hex, sizeof(hex));
+    CTP_LOG_HEX(CTP_LOG_LEVEL_INFO, "> ", data, sizeof(data));
+    CTP_LOG_HEX(CTP_LOG_LEVEL_DEBUG, "> ", data, sizeof(data));
+    ctp_log_ring_read(&ring, text_hex, sizeof(text_hex));
+    assert(strcmp(text_hex, "> 0000: A0 A1 A2 A3 A4 A5 A6 A7 A8 A9 AA AB AC AD AE AF\n"
+                            "> 0010: B0 B1 B2 B3\n") == 0);
+    printf("SEQ: 3 Passed\n");
+
+    ctp_log_set_sink(ctp_log_stderr, NULL);
+    return true;
+}
+
+int main() {
+    if (test_log_levels()) {
+        printf("Test Log Levels PASSED.\n");
+    } else {
+        printf("Test Log Levels FAILED.\n");
+    }
+
+    if (test_log_ring()) {
+        printf("Test Log Ring PASSED.\n");
+    } else {
+        printf("Test Log Ring FAILED.\n");
+    }
+
+    return 0;
+}
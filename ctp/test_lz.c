@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+
+#include "ctp.h"
+#include "ctp_lz.h"
+
+#define LOOPBACK_QUEUE_LEN 4096
+
+// Frames sent are received back in order
+CTP_CanFrame loopback_frames[LOOPBACK_QUEUE_LEN];
+uint32_t loopback_count = 0;
+uint32_t loopback_index = 0;
+
+bool loopback_send(void *handle, uint32_t id, const uint8_t *data, uint8_t length) {
+    if (loopback_count == LOOPBACK_QUEUE_LEN) {
+        return false;
+    }
+
+    CTP_CanFrame *frame = &loopback_frames[loopback_count++];
+    frame->id = id;
+    frame->len = length;
+    frame->timestamp_us = 0;
+    memcpy(frame->data, data, length);
+    return true;
+}
+
+bool loopback_receive(void *handle, uint32_t *id, uint8_t *data, uint8_t *length) {
+    if (loopback_index == loopback_count) {
+        return false;
+    }
+
+    CTP_CanFrame *frame = &loopback_frames[loopback_index++];
+    *id = frame->id;
+    *length = frame->len;
+    memcpy(data, frame->data, frame->len);
+    return true;
+}
+
+const CTP_Driver loopback_driver = {
+    .send = loopback_send,
+    .receive = loopback_receive,
+};
+
+// Calibration table like data: slowly changing values with repeating structure
+void fill_table(uint8_t *data, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        data[i] = (i % 16 < 8) ? (uint8_t)(i / 64) : (uint8_t)(i % 16);
+    }
+}
+
+// xorshift, nothing to compress
+void fill_random(uint8_t *data, uint32_t length) {
+    uint32_t x = 2463534242u;
+
+    for (uint32_t i = 0; i < length; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        data[i] = (uint8_t)x;
+    }
+}
+
+bool round_trip(const uint8_t *data, uint32_t length) {
+    static uint8_t compressed[CTP_LZ_BOUND(20000)];
+    static uint8_t decompressed[20000];
+    uint32_t compressed_length = ctp_lz_compress(data, length, compressed, CTP_LZ_BOUND(length));
+
+    return compressed_length > 0 && compressed_length <= CTP_LZ_BOUND(length) &&
+           ctp_lz_decompress(compressed, compressed_length, decompressed, length) == (int32_t)length &&
+           memcmp(decompressed, data, length) == 0;
+}
+
+bool test_round_trip() {
+    static uint8_t data[20000];
+    static uint8_t compressed[CTP_LZ_BOUND(sizeof(data))];
+    const uint32_t lengths[] = {0, 1, 3, 4, 5, 15, 16, 300, 4096, 4097, 20000};
+
+    fill_table(data, sizeof(data));
+    for (uint32_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        assert(round_trip(data, lengths[i]));
+    }
+
+    // Well over 3x, matches reach back across the whole window
+    uint32_t compressed_length = ctp_lz_compress(data, sizeof(data), compressed, sizeof(compressed));
+    assert(compressed_length * 3 < sizeof(data));
+    printf("SEQ: 1 Passed\n");
+
+    // Long runs need extra length bytes
+    memset(data, 0xAB, sizeof(data));
+    assert(round_trip(data, sizeof(data)));
+    assert(ctp_lz_compress(data, sizeof(data), compressed, sizeof(compressed)) < 100);
+    printf("SEQ: 2 Passed\n");
+
+    // Random data grows a little, but never beyond the bound
+    fill_random(data, sizeof(data));
+    for (uint32_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        assert(round_trip(data, lengths[i]));
+    }
+    assert(ctp_lz_compress(data, sizeof(data), compressed, sizeof(data)) == 0);
+    printf("SEQ: 3 Passed\n");
+
+    return true;
+}
+
+// Sink checking the data comes in order
+typedef struct {
+    uint8_t *buffer;
+    uint32_t next_offset;
+    uint32_t calls;
+} TestSink;
+
+bool test_sink(void *user, uint32_t offset, const uint8_t *data, uint32_t length) {
+    TestSink *sink = user;
+
+    if (offset != sink->next_offset || length > CTP_LZ_WINDOW_SIZE) {
+        return false;
+    }
+
+    memcpy(&sink->buffer[offset], data, length);
+    sink->next_offset += length;
+    sink->calls++;
+    return true;
+}
+
+bool test_streaming() {
+    static uint8_t data[20000];
+    static uint8_t compressed[CTP_LZ_BOUND(sizeof(data))];
+    static uint8_t decompressed[sizeof(data)];
+    CTP_LzDecoder dec;
+    TestSink sink = {.buffer = decompressed};
+
+    fill_table(data, sizeof(data));
+    uint32_t compressed_length = ctp_lz_compress(data, sizeof(data), compressed, sizeof(compressed));
+
+    // A byte at a time, the window wraps several times
+    ctp_lz_decoder_init_sink(&dec, test_sink, &sink);
+    for (uint32_t i = 0; i < compressed_length; i++) {
+        assert(dec.state != CTP_LZ_DONE);
+        assert(ctp_lz_decode(&dec, &compressed[i], 1));
+    }
+    assert(dec.state == CTP_LZ_DONE && sink.next_offset == sizeof(data));
+    assert(memcmp(decompressed, data, sizeof(data)) == 0);
+    printf("SEQ: 1 Passed\n");
+
+    // In pieces of CONSECUTIVE frame size through ctp_lz_sink
+    memset(decompressed, 0, sizeof(decompressed));
+    ctp_lz_decoder_init(&dec, decompressed, sizeof(decompressed));
+    for (uint32_t offset = 0; offset < compressed_length; offset += 6) {
+        uint32_t n = (compressed_length - offset < 6) ? compressed_length - offset : 6;
+
+        assert(ctp_lz_sink(&dec, offset, &compressed[offset], n));
+    }
+    assert(dec.state == CTP_LZ_DONE && memcmp(decompressed, data, sizeof(data)) == 0);
+
+    // Pieces out of order can't be decoded
+    ctp_lz_decoder_init(&dec, decompressed, sizeof(decompressed));
+    assert(!ctp_lz_sink(&dec, 6, &compressed[6], 6));
+    printf("SEQ: 2 Passed\n");
+
+    return true;
+}
+
+bool test_corrupt() {
+    static uint8_t data[2000];
+    static uint8_t compressed[CTP_LZ_BOUND(sizeof(data))];
+    static uint8_t decompressed[sizeof(data)];
+
+    fill_table(data, sizeof(data));
+    uint32_t compressed_length = ctp_lz_compress(data, sizeof(data), compressed, sizeof(compressed));
+
+    // Truncated, trailing data and too small a buffer
+    assert(ctp_lz_decompress(compressed, compressed_length - 1, decompressed, sizeof(decompressed)) == -1);
+    compressed[compressed_length] = 0;
+    assert(ctp_lz_decompress(compressed, compressed_length + 1, decompressed, sizeof(decompressed)) == -1);
+    assert(ctp_lz_decompress(compressed, compressed_length, decompressed, sizeof(data) - 1) == -1);
+    printf("SEQ: 1 Passed\n");
+
+    // A match reaching back before the start of the data
+    uint8_t bad_offset[] = {0, 0, 0, 8, 0x10, 'a', 2, 0};
+    assert(ctp_lz_decompress(bad_offset, sizeof(bad_offset), decompressed, sizeof(decompressed)) == -1);
+
+    // A match running past the announced length
+    uint8_t too_long[] = {0, 0, 0, 4, 0x14, 'a', 1, 0};
+    assert(ctp_lz_decompress(too_long, sizeof(too_long), decompressed, sizeof(decompressed)) == -1);
+
+    // The same overlapping match with the right length is a run
+    too_long[3] = 9;
+    assert(ctp_lz_decompress(too_long, sizeof(too_long), decompressed, sizeof(decompressed)) == 9);
+    assert(memcmp(decompressed, "aaaaaaaaa", 9) == 0);
+    printf("SEQ: 2 Passed\n");
+
+    return true;
+}
+
+bool test_ctp_transfer() {
+    static uint8_t data[20000];
+    static uint8_t work[CTP_LZ_BOUND(sizeof(data))];
+    static uint8_t received_data[sizeof(data)];
+    CTP_Context ctx;
+
+    ctp_init(&ctx, &loopback_driver, NULL);
+    fill_table(data, sizeof(data));
+
+    // A fraction of the frames go over the bus, the receiver decodes on the fly
+    loopback_count = 0;
+    loopback_index = 0;
+    assert(ctp_send_compressed(&ctx, 0x100, data, sizeof(data), work, sizeof(work), false, CTP_EXT_FLAG_CRC32) == sizeof(data));
+    assert(loopback_frames[0].data[1] == (CTP_EXT_FLAG_CRC32 | CTP_EXT_FLAG_LZ));
+    assert(loopback_count * 6 * 3 < sizeof(data));
+    assert(ctp_receive_compressed(&ctx, received_data, sizeof(received_data), false) == sizeof(data));
+    assert(memcmp(received_data, data, sizeof(data)) == 0);
+    printf("SEQ: 1 Passed\n");
+
+    // Compact framing on top
+    loopback_count = 0;
+    loopback_index = 0;
+    memset(received_data, 0, sizeof(received_data));
+    assert(ctp_send_compressed(&ctx, 0x100, data, sizeof(data), work, sizeof(work), false, CTP_EXT_FLAG_COMPACT) == sizeof(data));
+    assert(ctp_receive_compressed(&ctx, received_data, sizeof(received_data), false) == sizeof(data));
+    assert(memcmp(received_data, data, sizeof(data)) == 0);
+    printf("SEQ: 2 Passed\n");
+
+    // Random data goes out uncompressed, the receiver takes it as it is
+    fill_random(data, 1000);
+    loopback_count = 0;
+    loopback_index = 0;
+    assert(ctp_send_compressed(&ctx, 0x100, data, 1000, work, sizeof(work), false, 0) == 1000);
+    assert(loopback_frames[0].data[1] == 0);
+    assert(ctp_receive_compressed(&ctx, received_data, sizeof(received_data), false) == 1000);
+    assert(memcmp(received_data, data, 1000) == 0);
+
+    // Neither fits a buffer that is too small
+    loopback_index = 0;
+    assert(ctp_receive_compressed(&ctx, received_data, 999, false) == -1);
+
+    fill_table(data, sizeof(data));
+    loopback_count = 0;
+    loopback_index = 0;
+    assert(ctp_send_compressed(&ctx, 0x100, data, sizeof(data), work, sizeof(work), true, 0) == sizeof(data));
+    assert(ctp_receive_compressed(&ctx, received_data, sizeof(data) - 1, true) == -1);
+    printf("SEQ: 3 Passed\n");
+
+    return true;
+}
+
+int main() {
+    if (test_round_trip()) {
+        printf("Test Round Trip PASSED.\n");
+    } else {
+        printf("Test Round Trip FAILED.\n");
+    }
+
+    if (test_streaming()) {
+        printf("Test Streaming PASSED.\n");
+    } else {
+        printf("Test Streaming FAILED.\n");
+    }
+
+    if (test_corrupt()) {
+        printf("Test Corrupt PASSED.\n");
+    } else {
+        printf("Test Corrupt FAILED.\n");
+    }
+
+    if (test_ctp_transfer()) {
+        printf("Test CTP Transfer PASSED.\n");
+    } else {
+        printf("Test CTP Transfer FAILED.\n");
+    }
+
+    return 0;
+}
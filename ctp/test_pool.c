@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ctp.h"
+#include "ctp_pool.h"
+
+#define TEST_CHANNELS 2
+#define TEST_IDS 16
+#define TEST_ROUNDS 200
+#define TEST_LENGTH 1000
+
+// No more sessions than a single worker's table holds, however the IDs hash
+_Static_assert(TEST_CHANNELS * TEST_IDS <= CTP_RX_TABLE_SIZE, "sessions don't fit a worker");
+
+bool null_send(void *handle, uint32_t id, const uint8_t *data, uint8_t len) {
+    return true;
+}
+
+bool null_receive(void *handle, uint32_t *id, uint8_t *data, uint8_t *len) {
+    return false;
+}
+
+const CTP_Driver null_driver = {
+    .send = null_send,
+    .receive = null_receive,
+};
+
+CTP_Context channel_ctx[TEST_CHANNELS];
+CTP_Pool pool;
+uint8_t payload[TEST_LENGTH];
+_Atomic uint32_t received[TEST_CHANNELS];
+_Atomic uint32_t mismatches;
+
+// Every channel sends the same payload, shifted by its channel number
+void on_message(void *user, uint32_t channel, const CTP_Receiver *session) {
+    for (uint32_t i = 0; i < session->received_length; i++) {
+        if (session->buffer[i] != (uint8_t)(payload[i] + channel)) {
+            atomic_fetch_add(&mismatches, 1);
+            break;
+        }
+    }
+    atomic_fetch_add(&received[channel], 1);
+}
+
+// Bus thread of one channel, interleaves sequences of all its IDs like a busy bus
+void *channel_main(void *arg) {
+    uint32_t channel = (uint32_t)(uintptr_t)arg;
+    uint8_t data[TEST_LENGTH];
+    CTP_Encoder enc[TEST_IDS];
+    CTP_CanFrame frame;
+
+    for (int i = 0; i < TEST_LENGTH; i++) {
+        data[i] = payload[i] + channel;
+    }
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        bool active = true;
+
+        for (int id = 0; id < TEST_IDS; id++) {
+            ctp_encoder_init(&enc[id], data, TEST_LENGTH, true);
+        }
+
+        while (active) {
+            active = false;
+            for (int id = 0; id < TEST_IDS; id++) {
+                if ((frame.len = ctp_encoder_next(&enc[id], frame.data)) == 0) {
+                    continue;
+                }
+                frame.id = 0x100 + id;
+                active = true;
+
+                // Back off and retry, the test checks delivery. Every retry counts as a drop.
+                while (ctp_pool_dispatch(&pool, channel, &frame, 1) == 0) {
+                    usleep(10);
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+bool test_pool_reassembly() {
+    CTP_Context *channels[TEST_CHANNELS];
+    pthread_t threads[TEST_CHANNELS];
+    CTP_PoolStats stats;
+    uint64_t completed = 0;
+    uint64_t frames = 0;
+
+    for (int i = 0; i < TEST_LENGTH; i++) {
+        payload[i] = i * 7;
+    }
+
+    for (int c = 0; c < TEST_CHANNELS; c++) {
+        ctp_init(&channel_ctx[c], &null_driver, NULL);
+        channels[c] = &channel_ctx[c];
+    }
+
+    assert(ctp_pool_init(&pool, channels, TEST_CHANNELS, 3, true, on_message, NULL));
+    assert(ctp_pool_start(&pool));
+
+    for (int c = 0; c < TEST_CHANNELS; c++) {
+        pthread_create(&threads[c], NULL, channel_main, (void *)(uintptr_t)c);
+    }
+    for (int c = 0; c < TEST_CHANNELS; c++) {
+        pthread_join(threads[c], NULL);
+    }
+
+    // Wait for the workers to drain their rings
+    for (int tries = 0; tries < 1000; tries++) {
+        uint32_t depth = 0;
+
+        for (uint32_t w = 0; w < pool.worker_count; w++) {
+            ctp_pool_stats(&pool, w, &stats);
+            depth += stats.queue_depth;
+        }
+        if (depth == 0) {
+            break;
+        }
+        usleep(1000);
+    }
+    ctp_pool_stop(&pool);
+
+    for (uint32_t w = 0; w < pool.worker_count; w++) {
+        ctp_pool_stats(&pool, w, &stats);
+        assert(stats.errors == 0 && stats.queue_depth == 0);
+        completed += stats.completed;
+        frames += stats.frames;
+    }
+
+    assert(completed == TEST_CHANNELS * TEST_IDS * TEST_ROUNDS);
+    assert(frames == completed * ctp_sequence_frame_count(TEST_LENGTH, true));
+    assert(mismatches == 0);
+    for (int c = 0; c < TEST_CHANNELS; c++) {
+        assert(received[c] == TEST_IDS * TEST_ROUNDS);
+    }
+
+    ctp_pool_destroy(&pool);
+    return true;
+}
+
+bool test_pool_drops() {
+    CTP_Context *channels[1] = {&channel_ctx[0]};
+    CTP_CanFrame frame = {.id = 0x100, .len = 8};
+    CTP_PoolStats stats;
+
+    // Without running workers the ring of the ID's worker fills up
+    assert(ctp_pool_init(&pool, channels, 1, 2, false, NULL, NULL));
+
+    uint32_t worker = ctp_pool_worker_of(&pool, 0, frame.id);
+    uint32_t queued = 0;
+
+    for (int i = 0; i < CTP_POOL_RING_SIZE + 10; i++) {
+        queued += ctp_pool_dispatch(&pool, 0, &frame, 1);
+    }
+
+    ctp_pool_stats(&pool, worker, &stats);
+    assert(queued == CTP_POOL_RING_SIZE);
+    assert(stats.queue_depth == CTP_POOL_RING_SIZE && stats.dropped == 10);
+
+    ctp_pool_stats(&pool, 1 - worker, &stats);
+    assert(stats.queue_depth == 0 && stats.dropped == 0);
+
+    ctp_pool_destroy(&pool);
+    return true;
+}
+
+// Clock moving 100 us on every read
+_Atomic uint64_t clock_us;
+
+uint64_t ticking_now_us(void *handle) {
+    return atomic_fetch_add(&clock_us, 100) + 100;
+}
+
+const CTP_Driver clock_driver = {
+    .send = null_send,
+    .receive = null_receive,
+    .now_us = ticking_now_us,
+};
+
+_Atomic uint32_t expire_completed;
+
+void on_expire_message(void *user, uint32_t channel, const CTP_Receiver *session) {
+    atomic_fetch_add(&expire_completed, 1);
+}
+
+// Stalled sessions are dropped while the worker is busy, not only once it runs dry
+bool test_pool_expire() {
+    CTP_Context *channels[1] = {&channel_ctx[0]};
+    CTP_CanFrame frame;
+    CTP_Encoder enc;
+    CTP_PoolStats stats;
+    uint8_t data[20] = {0};
+
+    ctp_init(&channel_ctx[0], &clock_driver, NULL);
+    channel_ctx[0].timeouts.frame_us = 1000;
+    assert(ctp_pool_init(&pool, channels, 1, 1, false, on_expire_message, NULL));
+
+    // A START frame for every session the worker holds, nothing follows
+    for (uint32_t i = 0; i < CTP_RX_TABLE_SIZE; i++) {
+        ctp_encoder_init(&enc, data, sizeof(data), false);
+        frame.id = 0x200 + i;
+        frame.len = ctp_encoder_next(&enc, frame.data);
+        assert(ctp_pool_dispatch(&pool, 0, &frame, 1) == 1);
+    }
+
+    // Enough traffic of no session to keep the worker busy past its budget
+    frame = (CTP_CanFrame){.id = 0x7FF, .len = 8, .data = {CTP_CONSECUTIVE_FRAME}};
+    for (uint32_t i = 0; i < 2 * CTP_POOL_EXPIRE_FRAMES; i++) {
+        assert(ctp_pool_dispatch(&pool, 0, &frame, 1) == 1);
+    }
+
+    // A new sequence only finds a slot once stalled ones are gone
+    ctp_encoder_init(&enc, data, sizeof(data), false);
+    frame.id = 0x300;
+    while ((frame.len = ctp_encoder_next(&enc, frame.data)) > 0) {
+        assert(ctp_pool_dispatch(&pool, 0, &frame, 1) == 1);
+    }
+
+    assert(ctp_pool_start(&pool));
+    for (int tries = 0; tries < 1000; tries++) {
+        ctp_pool_stats(&pool, 0, &stats);
+        if (stats.queue_depth == 0 && expire_completed > 0) {
+            break;
+        }
+        usleep(1000);
+    }
+    ctp_pool_stop(&pool);
+
+    ctp_pool_stats(&pool, 0, &stats);
+    assert(expire_completed == 1 && stats.errors > 0);
+
+    // The worker never touched the channel's own context
+    assert(channel_ctx[0].stats.aborted == 0);
+
+    ctp_pool_destroy(&pool);
+    return true;
+}
+
+int main() {
+    if (test_pool_reassembly()) {
+        printf("Test Pool Reassembly PASSED.\n");
+    } else {
+        printf("Test Pool Reassembly FAILED.\n");
+    }
+
+    if (test_pool_drops()) {
+        printf("Test Pool Drops PASSED.\n");
+    } else {
+        printf("Test Pool Drops FAILED.\n");
+    }
+
+    if (test_pool_expire()) {
+        printf("Test Pool Expire PASSED.\n");
+    } else {
+        printf("Test Pool Expire FAILED.\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ctp.h"
+#include "ctp_ring.h"
+
+#define BUS_QUEUE_LEN 512
+#define THREAD_FRAMES 1000000
+
+// Loopback bus, everything sent is received again
+CTP_CanFrame bus_frames[BUS_QUEUE_LEN];
+uint32_t bus_count = 0;
+uint32_t bus_index = 0;
+uint32_t bus_batch_max = 0;             // Frames per receive_batch call, 0 disables the hook
+
+bool bus_send(void *handle, uint32_t id, const uint8_t *data, uint8_t len) {
+    CTP_CanFrame *frame = &bus_frames[bus_count++ % BUS_QUEUE_LEN];
+
+    frame->id = id;
+    frame->len = len;
+    frame->timestamp_us = bus_count;
+    memcpy(frame->data, data, len);
+    return true;
+}
+
+bool bus_receive(void *handle, uint32_t *id, uint8_t *data, uint8_t *len) {
+    if (bus_index == bus_count) {
+        return false;
+    }
+
+    CTP_CanFrame *frame = &bus_frames[bus_index++ % BUS_QUEUE_LEN];
+    *id = frame->id;
+    *len = frame->len;
+    memcpy(data, frame->data, frame->len);
+    return true;
+}
+
+uint32_t bus_receive_batch(void *handle, CTP_CanFrame *frames, uint32_t count) {
+    uint32_t n = 0;
+
+    while (n < count && n < bus_batch_max && bus_index < bus_count) {
+        frames[n++] = bus_frames[bus_index++ % BUS_QUEUE_LEN];
+    }
+
+    return n;
+}
+
+const CTP_Driver bus_driver = {
+    .send = bus_send,
+    .receive = bus_receive,
+};
+
+const CTP_Driver bus_batch_driver = {
+    .send = bus_send,
+    .receive = bus_receive,
+    .receive_batch = bus_receive_batch,
+};
+
+bool test_ring_push_pop() {
+    CTP_CanFrame slots[8];
+    CTP_CanFrame frame = {0};
+    CTP_Ring ring;
+
+    ctp_ring_init(&ring, slots, 8);
+
+    // Fill, drain half, and fill again so the indexes wrap over the slot array
+    for (uint32_t i = 0; i < 8; i++) {
+        frame.id = i;
+        assert(ctp_ring_push(&ring, &frame));
+    }
+    assert(!ctp_ring_push(&ring, &frame));
+
+    for (uint32_t i = 0; i < 4; i++) {
+        assert(ctp_ring_pop(&ring, &frame) && frame.id == i);
+    }
+    for (uint32_t i = 8; i < 12; i++) {
+        frame.id = i;
+        assert(ctp_ring_push(&ring, &frame));
+    }
+
+    CTP_CanFrame out[16];
+    assert(ctp_ring_pop_batch(&ring, out, 16) == 8);
+    for (uint32_t i = 0; i < 8; i++) {
+        assert(out[i].id == 4 + i);
+    }
+    assert(!ctp_ring_pop(&ring, &frame));
+
+    return true;
+}
+
+bool test_ring_pump() {
+    CTP_CanFrame slots[16];
+    CTP_CanFrame frame;
+    CTP_Ring ring;
+    uint8_t data[8] = {0};
+
+    // One frame at a time through receive, stops at a full ring
+    bus_count = bus_index = 0;
+    for (uint32_t i = 0; i < 20; i++) {
+        bus_send(NULL, i, data, 8);
+    }
+    ctp_ring_init(&ring, slots, 16);
+    assert(ctp_ring_pump(&ring, &bus_driver, NULL) == 16);
+    assert(bus_index == 16);
+    printf("SEQ: 1 Passed\n");
+
+    // Straight into the slots through receive_batch, split at the end of the array
+    for (uint32_t i = 0; i < 10; i++) {
+        assert(ctp_ring_pop(&ring, &frame) && frame.id == i);
+    }
+    bus_batch_max = 3;
+    assert(ctp_ring_pump(&ring, &bus_batch_driver, NULL) == 4);
+    for (uint32_t i = 10; i < 20; i++) {
+        assert(ctp_ring_pop(&ring, &frame) && frame.id == i);
+    }
+    assert(frame.timestamp_us == 20);
+    printf("SEQ: 2 Passed\n");
+
+    return true;
+}
+
+// A whole CTP sequence pumped through the ring into a context using the port
+bool test_ring_port() {
+    CTP_CanFrame slots[64];
+    CTP_Ring ring;
+    CTP_RingPort port;
+    CTP_Context ctx;
+    uint8_t data[300];
+    uint8_t received_data[sizeof(data)];
+
+    for (int i = 0; i < sizeof(data); i++) {
+        data[i] = i;
+    }
+
+    bus_count = bus_index = 0;
+    bus_batch_max = 16;
+    ctp_ring_init(&ring, slots, 64);
+    ctp_ring_port_init(&port, &ring, &bus_batch_driver, NULL);
+    ctp_init(&ctx, &port.driver, &port);
+    assert(port.driver.now_us == NULL && port.driver.send_batch == NULL);
+
+    assert(ctp_send(&ctx, 0x100, data, sizeof(data), false) == sizeof(data));
+    assert(ctp_ring_pump(&ring, &bus_batch_driver, NULL) == bus_count);
+    assert(ctp_receive_seq(&ctx, received_data, sizeof(received_data), false) == sizeof(data));
+    assert(memcmp(received_data, data, sizeof(data)) == 0);
+
+    return true;
+}
+
+CTP_Ring thread_ring;
+CTP_CanFrame thread_slots[256];
+
+void *producer(void *arg) {
+    CTP_CanFrame frame = {.len = 8};
+
+    for (uint32_t i = 0; i < THREAD_FRAMES; i++) {
+        frame.id = i;
+        memcpy(frame.data, &i, sizeof(i));
+        while (!ctp_ring_push(&thread_ring, &frame)) {
+        }
+    }
+
+    return NULL;
+}
+
+bool test_ring_threads() {
+    pthread_t thread;
+    CTP_CanFrame frames[32];
+    uint32_t expected = 0;
+
+    ctp_ring_init(&thread_ring, thread_slots, 256);
+    pthread_create(&thread, NULL, producer, NULL);
+
+    while (expected < THREAD_FRAMES) {
+        uint32_t n = ctp_ring_pop_batch(&thread_ring, frames, 32);
+
+        for (uint32_t i = 0; i < n; i++, expected++) {
+            uint32_t value;
+
+            memcpy(&value, frames[i].data, sizeof(value));
+            assert(frames[i].id == expected && value == expected);
+        }
+    }
+
+    pthread_join(thread, NULL);
+    return true;
+}
+
+int main() {
+    if (test_ring_push_pop()) {
+        printf("Test Ring Push Pop PASSED.\n");
+    } else {
+        printf("Test Ring Push Pop FAILED.\n");
+    }
+
+    if (test_ring_pump()) {
+        printf("Test Ring Pump PASSED.\n");
+    } else {
+        printf("Test Ring Pump FAILED.\n");
+    }
+
+    if (test_ring_port()) {
+        printf("Test Ring Port PASSED.\n");
+    } else {
+        printf("Test Ring Port FAILED.\n");
+    }
+
+    if (test_ring_threads()) {
+        printf("Test Ring Threads PASSED.\n");
+    } else {
+        printf("Test Ring Threads FAILED.\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+
+#include "ctp.h"
+#include "ctp_timing.h"
+
+bool test_frame_bits() {
+    CTP_BusTiming classic = {.bitrate = 500000};
+    CTP_BusTiming extended = {.bitrate = 500000, .extended_id = true};
+    CTP_BusTiming fd = {.bitrate = 500000, .data_bitrate = 2000000, .fd = true};
+    CTP_FrameBits bits;
+
+    // 8 data bytes: 98 stuffable bits, 24 stuff bits worst case and 13 more
+    assert(ctp_timing_frame_bits(&classic, 8).nominal == 135);
+    assert(ctp_timing_frame_bits(&classic, 0).nominal == 55);
+    assert(ctp_timing_frame_bits(&extended, 8).nominal == 160);
+    assert(ctp_timing_frame_ns(&classic, 8) == 270000);
+    printf("SEQ: 1 Passed\n");
+
+    // 17 arbitration bits with 4 stuff bits and 13 more at the nominal rate.
+    // ESI, DLC and 64 bytes are 517 bits, with 129 stuff bits, then the stuff
+    // count and a 21 bit CRC with 7 fixed stuff bits.
+    bits = ctp_timing_frame_bits(&fd, 64);
+    assert(bits.nominal == 34 && bits.data == 678);
+    assert(ctp_timing_frame_ns(&fd, 64) == 34 * 2000 + 678 * 500);
+
+    // Padded to the next valid length, a 17 bit CRC up to 16 bytes
+    assert(ctp_length_to_dlc(8) == 8 && ctp_length_to_dlc(9) == 9 && ctp_dlc_to_length(9) == 12);
+    assert(ctp_length_to_dlc(33) == 14 && ctp_length_to_dlc(64) == 15 && ctp_dlc_to_length(15) == 64);
+    assert(ctp_timing_frame_bits(&fd, 13).data == ctp_timing_frame_bits(&fd, 16).data);
+    assert(ctp_timing_frame_bits(&fd, 16).data == 193);
+    assert(ctp_timing_frame_bits(&fd, 17).data == 238);
+
+    // Padded frames take as long as full ones
+    classic.min_length = 8;
+    assert(ctp_timing_frame_bits(&classic, 2).nominal == 135);
+    fd.min_length = 8;
+    assert(ctp_timing_frame_bits(&fd, 2).data == ctp_timing_frame_bits(&fd, 8).data);
+    fd.min_length = 0;
+
+    // Without bit rate switching everything runs at the nominal rate
+    fd.data_bitrate = 0;
+    assert(ctp_timing_frame_bits(&fd, 64).nominal == 712);
+    printf("SEQ: 2 Passed\n");
+
+    return true;
+}
+
+// Wire time of the frames ctp_encode_sequence() produces for a ctp_send()
+uint64_t encoded_busy_ns(const CTP_BusTiming *bus, const uint8_t *data, uint32_t length, uint32_t *frame_count) {
+    static CTP_CanFrame frames[MAX_SEQUENCE_NUM + 2];
+    uint32_t max_len = bus->fd ? CTP_FD_MAX_SEQUENCE_LENGTH : CTP_MAX_SEQUENCE_LENGTH;
+    uint64_t ns = 0;
+
+    *frame_count = 0;
+    while (length > 0) {
+        uint16_t chunk_length = (length > max_len) ? max_len : length;
+        uint32_t count = ctp_encode_sequence(0x123, data, chunk_length, bus->fd, frames, MAX_SEQUENCE_NUM + 2);
+
+        for (uint32_t i = 0; i < count; i++) {
+            ns += ctp_timing_frame_ns(bus, frames[i].len);
+        }
+        *frame_count += count;
+        data += chunk_length;
+        length -= chunk_length;
+    }
+
+    return ns;
+}
+
+bool test_estimate_chunking() {
+    static uint8_t data[40000];
+    const uint32_t lengths[] = {1, 5, 6, 12, 100, 1535, 1536, 1537, 4000, 15937, 40000};
+    CTP_BusTiming buses[] = {
+        {.bitrate = 500000},
+        {.bitrate = 250000, .extended_id = true},
+        {.bitrate = 500000, .data_bitrate = 2000000, .fd = true},
+    };
+    CTP_TimingEstimate estimate;
+
+    for (uint32_t b = 0; b < sizeof(buses) / sizeof(buses[0]); b++) {
+        for (uint32_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+            uint32_t frames;
+            uint64_t busy_ns = encoded_busy_ns(&buses[b], data, lengths[i], &frames);
+
+            ctp_timing_estimate(&buses[b], NULL, lengths[i], &estimate);
+            assert(estimate.frames == frames);
+            assert(estimate.busy_ns == busy_ns);
+            assert(estimate.time_ns == busy_ns && estimate.bus_load == 1.0);
+            assert(estimate.flow_control_frames == 0);
+        }
+    }
+    printf("SEQ: 1 Passed\n");
+
+    // Two full classic sequences and one more byte
+    ctp_timing_estimate(&buses[0], NULL, 2 * CTP_MAX_SEQUENCE_LENGTH + 1, &estimate);
+    assert(estimate.sequences == 3 && estimate.frames == 2 * (MAX_SEQUENCE_NUM + 2) + 1);
+    printf("SEQ: 2 Passed\n");
+
+    return true;
+}
+
+bool test_estimate_flow_control() {
+    CTP_BusTiming bus = {.bitrate = 500000};
+    CTP_FlowControl fc = {.enabled = true, .block_size = 2, .st_min = 0xF5};
+    CTP_TimingEstimate estimate;
+    uint64_t full = ctp_timing_frame_ns(&bus, 8);
+    uint64_t end = ctp_timing_frame_ns(&bus, 4);
+    uint64_t flow = ctp_timing_frame_ns(&bus, CTP_FLOW_CONTROL_FRAME_LENGTH);
+
+    // START, 3 CONSECUTIVE frames and an END frame with 3 bytes. The receiver
+    // answers the START frame and the first block, frames inside a block are
+    // 500 us apart.
+    ctp_timing_estimate(&bus, &fc, 26, &estimate);
+    assert(estimate.frames == 5 && estimate.flow_control_frames == 2);
+    assert(estimate.busy_ns == 4 * full + end + 2 * flow);
+    assert(estimate.time_ns == full + flow + 500000 + full + flow + 500000 + end);
+    assert(estimate.bus_load < 1.0);
+    printf("SEQ: 1 Passed\n");
+
+    // Retransmission adds the receiver's confirmation
+    fc = (CTP_FlowControl){.retransmit = true};
+    ctp_timing_estimate(&bus, &fc, 26, &estimate);
+    assert(estimate.flow_control_frames == 1);
+    assert(estimate.time_ns == 4 * full + end + flow);
+    printf("SEQ: 2 Passed\n");
+
+    return true;
+}
+
+int main() {
+    if (test_frame_bits()) {
+        printf("Test Frame Bits PASSED.\n");
+    } else {
+        printf("Test Frame Bits FAILED.\n");
+    }
+
+    if (test_estimate_chunking()) {
+        printf("Test Estimate Chunking PASSED.\n");
+    } else {
+        printf("Test Estimate Chunking FAILED.\n");
+    }
+
+    if (test_estimate_flow_control()) {
+        printf("Test Estimate Flow Control PASSED.\n");
+    } else {
+        printf("Test Estimate Flow Control FAILED.\n");
+    }
+
+    return 0;
+}
@@ -3,22 +3,23 @@
 #include <string.h>
 
 #include "ctp.h"
+#include "ctp_driver.h"
 
 
 #define CTP_ID 0x123
 
-void send_command(uint32_t id, const char *command, const char *args) {
+void send_command(CTP_Context *ctx, uint32_t id, const char *command, const char *args) {
     char buffer[1024];
     snprintf(buffer, sizeof(buffer), "%s;%s", command, args);
-    ctp_send(id, buffer, strlen(buffer), false);
+    ctp_send(ctx, id, buffer, strlen(buffer), false);
 }
 
-void send_query(char *response, char *query) {
+void send_query(CTP_Context *ctx, char *response, char *query) {
     uint32_t received_length;
 
     // Send a query
-    send_command(CTP_ID, "QUERY", query);
-    received_length = ctp_receive(response, sizeof(response) - 1, false);
+    send_command(ctx, CTP_ID, "QUERY", query);
+    received_length = ctp_receive(ctx, response, sizeof(response) - 1, false);
 
     if (received_length >= 0) {
         response[received_length] = '\0';
@@ -29,11 +30,19 @@ void send_query(char *response, char *query) {
 int main() {
     char response[1024];
     uint32_t received_length;
+    PCAN_Channel pcan;
+    CTP_Context ctx_storage;
+    CTP_Context *ctx = &ctx_storage;
 
+    if (init_pcan(&pcan, 0, 500) != 0) {
+        return 1;
+    }
+
+    ctp_init(ctx, &pcan_driver, &pcan);
 
     // Request a download
-    send_command(CTP_ID, "QUERY", "SET myval val");
-    received_length = ctp_receive(response, sizeof(response) - 1, false);
+    send_command(ctx, CTP_ID, "QUERY", "SET myval val");
+    received_length = ctp_receive(ctx, response, sizeof(response) - 1, false);
 
     if (received_length >= 0) {
         response[received_length] = '\0';
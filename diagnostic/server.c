@@ -3,6 +3,8 @@
 #include <stdlib.h>
 
 #include "ctp.h"
+#include "ctp_log.h"
+#include "server.h"
 
 #define CTP_ID 0x123
 
@@ -65,7 +67,7 @@ const char* process_upload(const char *key, const char *byte_blob, size_t size)
     
     // Check if database is full
     if (database_size >= MAX_DATABASE_SIZE) {
-        printf("[DEBUG] %s", "Error: Database full, cannot upload more data.\\n");
+        CTP_LOG_WARN("Database full, cannot upload more data.");
         return "Error: Database full, cannot upload more data.\\n";
     }
 
@@ -73,7 +75,7 @@ const char* process_upload(const char *key, const char *byte_blob, size_t size)
     strncpy(database[database_size].key, key, 50);
 
     database[database_size].size = size;
-    printf("[DEBUG] Uploaded %s: %.*s\\n", key, (int)size, byte_blob);
+    CTP_LOG_DEBUG("Uploaded %s: %.*s", key, (int)size, byte_blob);
 
     // Increment the database size
     database_size++;
@@ -89,27 +91,27 @@ const char* process_download(const char *key) {
         if (strncmp(database[i].key, key, 50) == 0) {
             // Found the key, send the byte blob
             char msg_data_for_key[] = "Data for key ";
-            printf("[DEBUG] %s%s: %.*s\\n", msg_data_for_key, key, (int)database[i].size, database[i].value);
+            CTP_LOG_DEBUG("%s%s: %.*s", msg_data_for_key, key, (int)database[i].size, database[i].value);
             return "Download successful.\\n";
         }
     }
 
     // Key not found
-    printf("[DEBUG] %s", "Error: Key not found.\\n");
+    CTP_LOG_DEBUG("Key not found: %s", key);
     return "Error: Key not found.\\n";
 }
 
-int server_listen(void) {
+int server_listen(CTP_Context *ctx) {
     char buffer[1024];
-    ssize_t received_length;
+    int32_t received_length;
 
-    printf("Server is running...\n");
+    CTP_LOG_INFO("Server is running...");
 
     while (1) {
         // Receive message
-        received_length = ctp_receive((uint8_t*)buffer, sizeof(buffer) - 1, false);
+        received_length = ctp_receive(ctx, (uint8_t*)buffer, sizeof(buffer) - 1, false);
         if (received_length < 0) {
-            perror("receive");
+            CTP_LOG_WARN("Receive failed");
             continue;
         }
 
@@ -125,20 +127,20 @@ int server_listen(void) {
         else if (strcmp(command, "QUERY") == 0) {
             char res[32];
             strcpy(res, process_query(args));
-            ctp_send(CTP_ID, (uint8_t*)res, strlen(res), false);
+            ctp_send(ctx, CTP_ID, (uint8_t*)res, strlen(res), false);
         } 
         else if (strcmp(command, "DOWNLOAD") == 0) {
             char res[64];
             strcpy(res, process_download(args));
-            ctp_send(CTP_ID, (uint8_t*)res, strlen(res), false);
+            ctp_send(ctx, CTP_ID, (uint8_t*)res, strlen(res), false);
         } 
         else if (strcmp(command, "UPLOAD") == 0) {
             char res[64];
             strncpy(res, process_upload(args, args, strlen(args)), sizeof(res));
-            ctp_send(CTP_ID, (uint8_t*)res, strlen(res), false);
+            ctp_send(ctx, CTP_ID, (uint8_t*)res, strlen(res), false);
         } 
         else {
-            printf("Unknown command: %s\n", command);
+            CTP_LOG_WARN("Unknown command: %s", command);
         }
     }
 
@@ -1,7 +1,10 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include "ctp.h"
+
 const char* get_value(const char* key);
 const char* process_query(const char *query);
+int server_listen(CTP_Context *ctx);
 
 #endif
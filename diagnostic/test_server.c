@@ -7,25 +7,6 @@
 #include "ctp.h"  
 
 
-
-
-// We need these driver functions to compile the server.c file
-// since it depends on ctp, however in our tests we don't actually
-// use the ctp functions, so we can just stub them out
-bool send_ctp_message(uint32_t id, uint8_t *data, uint8_t length) {
-    (void)id;
-    (void)data;
-    (void)length;
-    return true;
-}
-
-bool receive_ctp_message(uint32_t *id, uint8_t *data, uint8_t *length) {
-    (void)id;
-    (void)data;
-    (void)length;
-    return true;
-}
-
 void test_set_query_processing() {
     // Test 1: Set a value for a key
     assert(strcmp(process_query("SET key1 value1"), "SET successful\n") == 0);
@@ -5,70 +5,219 @@
 #include <stdbool.h>
 
 #include "ctp.h"  
+#include "ctp_log.h"
+#include "ctp_driver.h"
 #include "PCBUSB.h"
 
-// Global pcan channel for processes to use
-uint32_t pcan_channel = PCAN_USBBUS1;
+// Bit timing for CAN_InitializeFD, on the 80 MHz clock of the PCAN-USB FD
+#define PCAN_FD_CLOCK_MHZ 80
+#define PCAN_FD_BITRATE_MAX 256
 
+typedef struct {
+    uint32_t baud_rate;                 // kbit/s
+    uint16_t brp;
+    uint16_t tseg1;
+    uint16_t tseg2;
+    uint16_t sjw;                       // Resynchronization jump width
+} PCAN_BitTiming;
+
+// 16 time quanta per bit, sampled at 81%, SJW as wide as phase segment 2
+static const PCAN_BitTiming pcan_nominal_timings[] = {
+    {1000, 5, 12, 3, 3},
+    {500, 10, 12, 3, 3},
+    {250, 20, 12, 3, 3},
+    {125, 40, 12, 3, 3},
+};
+
+// Sampled at 80%, SJW as wide as phase segment 2
+static const PCAN_BitTiming pcan_data_timings[] = {
+    {8000, 1, 7, 2, 2},
+    {5000, 1, 12, 3, 3},
+    {4000, 2, 7, 2, 2},
+    {2000, 2, 15, 4, 4},
+    {1000, 4, 15, 4, 4},
+};
+
+static const PCAN_BitTiming *pcan_find_timing(const PCAN_BitTiming *timings, uint32_t count, uint32_t baud_rate) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (timings[i].baud_rate == baud_rate) {
+            return &timings[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Frame format of a CTP ID, CTP_ID_EXTENDED selects a 29 bit ID
+static TPCANMessageType pcan_message_type(uint32_t id) {
+    return CTP_ID_IS_EXTENDED(id) ? PCAN_MESSAGE_EXTENDED : PCAN_MESSAGE_STANDARD;
+}
+
+static uint32_t pcan_ctp_id(DWORD id, TPCANMessageType type) {
+    return (type & PCAN_MESSAGE_EXTENDED) ? (CTP_ID_EXTENDED | id) : id;
+}
+
+// CAN FD frames are padded up to the next length a DLC can express
+static bool pcan_send_fd(PCAN_Channel *pcan, uint32_t id, const uint8_t *data, uint8_t length) {
+    TPCANStatus status;
+    TPCANMsgFD message;
+
+    message.ID = id & CTP_EXTENDED_ID_MAX;
+    message.MSGTYPE = pcan_message_type(id) | PCAN_MESSAGE_FD | (pcan->brs ? PCAN_MESSAGE_BRS : 0);
+    message.DLC = ctp_length_to_dlc(length);
+    memcpy(message.DATA, data, length);
+    memset(&message.DATA[length], 0, ctp_dlc_to_length(message.DLC) - length);
+
+    status = CAN_WriteFD(pcan->channel, &message);
+
+    if (status != PCAN_ERROR_OK) {
+        CTP_LOG_WARN("Failed to send CAN FD message: 0x%x", status);
+        return false;
+    }
+
+    return true;
+}
 
 // Driver function for PCAN-USB MAC, used by the CTP to send frames to the CAN bus
-bool send_ctp_message(uint32_t id, uint8_t *data, uint8_t length) {
+static bool pcan_send(void *handle, uint32_t id, const uint8_t *data, uint8_t length) {
+    PCAN_Channel *pcan = handle;
     TPCANStatus status;
     TPCANMsg message;
 
-    message.ID = id;
+    if (pcan->fd) {
+        return pcan_send_fd(pcan, id, data, length);
+    }
+
+    message.ID = id & CTP_EXTENDED_ID_MAX;
     message.LEN = length;
-    message.MSGTYPE = PCAN_MESSAGE_STANDARD;
+    message.MSGTYPE = pcan_message_type(id);
     memcpy(message.DATA, data, message.LEN);
 
-    status = CAN_Write(pcan_channel, &message);
+    status = CAN_Write(pcan->channel, &message);
 
     if (status != PCAN_ERROR_OK) {
-        printf("Failed to send CAN message: 0x%x\n", status);
+        CTP_LOG_WARN("Failed to send CAN message: 0x%x", status);
         return false;
     }
 
     return true;
 }
 
-// Driver function for PCAN-USB MAC, used by the CTP to get frames from the CAN bus
-bool receive_ctp_message(uint32_t *id, uint8_t *data, uint8_t *length) {
+// Hardware receive time in microseconds, millis wraps into millis_overflow
+static uint64_t pcan_timestamp_us(const TPCANTimestamp *timestamp) {
+    uint64_t millis = ((uint64_t)timestamp->millis_overflow << 32) | timestamp->millis;
+
+    return millis * 1000 + timestamp->micros;
+}
+
+// FD timestamps come in microseconds already
+static uint32_t pcan_receive_batch_fd(PCAN_Channel *pcan, CTP_CanFrame *frames, uint32_t count) {
+    TPCANMsgFD message;
+    TPCANTimestampFD timestamp;
+    uint32_t n = 0;
+
+    while (n < count && CAN_ReadFD(pcan->channel, &message, &timestamp) == PCAN_ERROR_OK) {
+        frames[n].id = pcan_ctp_id(message.ID, message.MSGTYPE);
+        frames[n].len = ctp_dlc_to_length(message.DLC);
+        frames[n].timestamp_us = timestamp;
+        memcpy(frames[n].data, message.DATA, frames[n].len);
+        n++;
+    }
+
+    return n;
+}
+
+// Drain up to count frames from the receive queue, frames carry the hardware
+// receive timestamp
+static uint32_t pcan_receive_batch(void *handle, CTP_CanFrame *frames, uint32_t count) {
+    PCAN_Channel *pcan = handle;
     TPCANMsg message;
-    TPCANStatus status;
+    TPCANTimestamp timestamp;
+    uint32_t n = 0;
+
+    if (pcan->fd) {
+        return pcan_receive_batch_fd(pcan, frames, count);
+    }
 
-    status = CAN_Read(pcan_channel, &message, NULL);
+    while (n < count && CAN_Read(pcan->channel, &message, &timestamp) == PCAN_ERROR_OK) {
+        frames[n].id = pcan_ctp_id(message.ID, message.MSGTYPE);
+        frames[n].len = message.LEN;
+        frames[n].timestamp_us = pcan_timestamp_us(&timestamp);
+        memcpy(frames[n].data, message.DATA, message.LEN);
+        n++;
+    }
+
+    return n;
+}
+
+// Driver function for PCAN-USB MAC, used by the CTP to get frames from the CAN bus
+static bool pcan_receive(void *handle, uint32_t *id, uint8_t *data, uint8_t *length) {
+    CTP_CanFrame frame;
 
-    if (status == PCAN_ERROR_OK) {        
-        *id = message.ID;
-        *length = message.LEN;
-        memcpy(data, message.DATA, message.LEN);
-    } 
-    else if (status == PCAN_ERROR_QRCVEMPTY) {
+    if (pcan_receive_batch(handle, &frame, 1) == 0) {
         return false;
-    } 
-    else {
+    }
+
+    *id = frame.id;
+    *length = frame.len;
+    memcpy(data, frame.data, frame.len);
+    return true;
+}
+
+// Program the adapter's message filter. The driver widens it with every
+// range, so it lets through everything from the lowest to the highest ID of a
+// frame format and the CTP drops the rest.
+static bool pcan_set_filter(void *handle, const CTP_IdRange *ranges, uint32_t count) {
+    PCAN_Channel *pcan = handle;
+    uint32_t filter = (count == 0) ? PCAN_FILTER_OPEN : PCAN_FILTER_CLOSE;
+    TPCANStatus status;
+
+    status = CAN_SetValue(pcan->channel, PCAN_MESSAGE_FILTER, &filter, sizeof(filter));
+    if (status != PCAN_ERROR_OK) {
+        CTP_LOG_ERROR("Failed to reset the message filter, Status = 0x%x", status);
         return false;
     }
 
+    for (uint32_t i = 0; i < count; i++) {
+        status = CAN_FilterMessages(pcan->channel, ranges[i].first & CTP_EXTENDED_ID_MAX, ranges[i].last & CTP_EXTENDED_ID_MAX,
+                                    CTP_ID_IS_EXTENDED(ranges[i].first) ? PCAN_MODE_EXTENDED : PCAN_MODE_STANDARD);
+
+        if (status != PCAN_ERROR_OK) {
+            CTP_LOG_ERROR("Failed to set the message filter, Status = 0x%x", status);
+
+            // A half set filter would drop frames the CTP wants
+            filter = PCAN_FILTER_OPEN;
+            CAN_SetValue(pcan->channel, PCAN_MESSAGE_FILTER, &filter, sizeof(filter));
+            return false;
+        }
+    }
+
     return true;
 }
 
-uint32_t init_pcan(uint32_t channel, uint32_t baud_rate) {
-    uint32_t status = false;
+const CTP_Driver pcan_driver = {
+    .send = pcan_send,
+    .receive = pcan_receive,
+    .receive_batch = pcan_receive_batch,
+    .set_filter = pcan_set_filter,
+};
 
-    uint32_t channel_map[] = {
-        PCAN_USBBUS1,
-        PCAN_USBBUS2,
-        PCAN_USBBUS3,
-        PCAN_USBBUS4,
-        PCAN_USBBUS5,
-        PCAN_USBBUS6,
-        PCAN_USBBUS7,
-        PCAN_USBBUS8
-    };
+static const uint32_t channel_map[] = {
+    PCAN_USBBUS1,
+    PCAN_USBBUS2,
+    PCAN_USBBUS3,
+    PCAN_USBBUS4,
+    PCAN_USBBUS5,
+    PCAN_USBBUS6,
+    PCAN_USBBUS7,
+    PCAN_USBBUS8
+};
+
+uint32_t init_pcan(PCAN_Channel *pcan, uint32_t channel, uint32_t baud_rate) {
+    uint32_t status = false;
 
     if (channel > 7) {
-        printf("Invalid channel: %d\n", channel);
+        CTP_LOG_ERROR("Invalid channel: %d", channel);
         return 1;
     }
 
@@ -86,19 +235,79 @@ uint32_t init_pcan(uint32_t channel, uint32_t baud_rate) {
             break;
 
         default:
-            printf("Invalid baud rate: %d\n", baud_rate);
+            CTP_LOG_ERROR("Invalid baud rate: %d", baud_rate);
             return 1;
     }
 
-    pcan_channel = channel_map[channel];
+    pcan->channel = channel_map[channel];
+    pcan->fd = false;
+    pcan->brs = false;
 
-    status = CAN_Initialize(pcan_channel, baud_rate, 0, 0, 0);
-    printf("Initialize CAN, Status = 0x%x\n", status);
+    status = CAN_Initialize(pcan->channel, baud_rate, 0, 0, 0);
+    CTP_LOG_INFO("Initialize CAN, Status = 0x%x", status);
 
     if (status != PCAN_ERROR_OK) {
-            printf("Failed to initialize CAN\n");
+            CTP_LOG_ERROR("Failed to initialize CAN");
             return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+// Initialize a channel for CAN FD with a PCAN bit rate string, e.g.
+// "f_clock_mhz=80, nom_brp=10, nom_tseg1=12, nom_tseg2=3, nom_sjw=3, data_brp=2, ..."
+// Frames are sent with bit rate switching, clear pcan->brs to send them at
+// the nominal rate.
+uint32_t init_pcan_fd_bitrate(PCAN_Channel *pcan, uint32_t channel, const char *bitrate) {
+    uint32_t status;
+    char buffer[PCAN_FD_BITRATE_MAX];
+
+    if (channel > 7) {
+        CTP_LOG_ERROR("Invalid channel: %d", channel);
+        return 1;
+    }
+
+    pcan->channel = channel_map[channel];
+    pcan->fd = true;
+    pcan->brs = true;
+
+    // The API takes a non-const string
+    snprintf(buffer, sizeof(buffer), "%s", bitrate);
+
+    status = CAN_InitializeFD(pcan->channel, buffer);
+    CTP_LOG_INFO("Initialize CAN FD, Status = 0x%x", status);
+
+    if (status != PCAN_ERROR_OK) {
+        CTP_LOG_ERROR("Failed to initialize CAN FD");
+        return 1;
+    }
+
+    return 0;
+}
+
+// Initialize a channel for CAN FD, baud_rate is the nominal and data_baud_rate
+// the data phase bit rate in kbit/s
+uint32_t init_pcan_fd(PCAN_Channel *pcan, uint32_t channel, uint32_t baud_rate, uint32_t data_baud_rate) {
+    const PCAN_BitTiming *nominal = pcan_find_timing(pcan_nominal_timings,
+                                                     sizeof(pcan_nominal_timings) / sizeof(pcan_nominal_timings[0]), baud_rate);
+    const PCAN_BitTiming *data = pcan_find_timing(pcan_data_timings,
+                                                  sizeof(pcan_data_timings) / sizeof(pcan_data_timings[0]), data_baud_rate);
+    char bitrate[PCAN_FD_BITRATE_MAX];
+
+    if (nominal == NULL) {
+        CTP_LOG_ERROR("Invalid baud rate: %d", baud_rate);
+        return 1;
+    }
+    if (data == NULL) {
+        CTP_LOG_ERROR("Invalid data baud rate: %d", data_baud_rate);
+        return 1;
+    }
+
+    snprintf(bitrate, sizeof(bitrate),
+             "f_clock_mhz=%u, nom_brp=%u, nom_tseg1=%u, nom_tseg2=%u, nom_sjw=%u, "
+             "data_brp=%u, data_tseg1=%u, data_tseg2=%u, data_sjw=%u",
+             PCAN_FD_CLOCK_MHZ, nominal->brp, nominal->tseg1, nominal->tseg2, nominal->sjw,
+             data->brp, data->tseg1, data->tseg2, data->sjw);
+
+    return init_pcan_fd_bitrate(pcan, channel, bitrate);
+}
@@ -0,0 +1,24 @@
+#ifndef CTP_DRIVER_H
+#define CTP_DRIVER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ctp.h"
+
+// PCAN channel state, used as the CTP driver handle
+typedef struct {
+    uint32_t channel;
+    bool fd;                            // Initialized for CAN FD, frames up to 64 bytes
+    bool brs;                           // Send FD frames with bit rate switching
+} PCAN_Channel;
+
+// Driver for PCAN-USB MAC, pass a PCAN_Channel as the handle to ctp_init.
+// Received frames carry the adapter's hardware timestamp.
+extern const CTP_Driver pcan_driver;
+
+uint32_t init_pcan(PCAN_Channel *pcan, uint32_t channel, uint32_t baud_rate);
+uint32_t init_pcan_fd(PCAN_Channel *pcan, uint32_t channel, uint32_t baud_rate, uint32_t data_baud_rate);
+uint32_t init_pcan_fd_bitrate(PCAN_Channel *pcan, uint32_t channel, const char *bitrate);
+
+#endif
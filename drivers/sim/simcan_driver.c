@@ -0,0 +1,284 @@
+#include <string.h>
+
+#include "ctp.h"
+#include "ctp_timing.h"
+#include "simcan_driver.h"
+
+// Bus time a receive call on an idle bus lets pass, so timeouts still expire
+#ifndef SIMCAN_IDLE_POLL_US
+#define SIMCAN_IDLE_POLL_US 10
+#endif
+
+
+void init_simcan(SimCAN_Bus *bus, uint32_t node_count, uint32_t bitrate, uint32_t data_bitrate, uint64_t seed) {
+    memset(bus, 0, sizeof(*bus));
+    bus->node_count = (node_count > SIMCAN_MAX_NODES) ? SIMCAN_MAX_NODES : node_count;
+    bus->bitrate = bitrate;
+    bus->data_bitrate = data_bitrate;
+
+    // xorshift has no way out of an all zero state
+    bus->rng = seed ? seed : 0x9E3779B97F4A7C15u;
+
+    for (uint32_t i = 0; i < bus->node_count; i++) {
+        bus->nodes[i].bus = bus;
+        bus->nodes[i].index = i;
+    }
+}
+
+SimCAN_Node *simcan_node(SimCAN_Bus *bus, uint32_t index) {
+    return (index < bus->node_count) ? &bus->nodes[index] : NULL;
+}
+
+// Deliver frames for node to listener instead of its RX queue, NULL restores the queue
+void simcan_listen(SimCAN_Node *node, SimCAN_Listener listener, void *user) {
+    node->listener = listener;
+    node->listener_user = user;
+}
+
+// xorshift64*, uniform in [0, 1)
+static double simcan_random(SimCAN_Bus *bus) {
+    bus->rng ^= bus->rng >> 12;
+    bus->rng ^= bus->rng << 25;
+    bus->rng ^= bus->rng >> 27;
+
+    return ((bus->rng * 0x2545F4914F6CDD1Du) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool simcan_chance(SimCAN_Bus *bus, double probability) {
+    return probability > 0 && simcan_random(bus) < probability;
+}
+
+// Time a frame occupies the bus, worst case bit stuffing and the interframe
+// space included. IDs with CTP_ID_EXTENDED are sent as 29 bit IDs and frames
+// longer than 8 bytes as CAN FD frames, with the data phase at data_bitrate.
+uint64_t simcan_frame_ns(const SimCAN_Bus *bus, uint32_t id, uint8_t len) {
+    CTP_BusTiming timing = {
+        .bitrate = bus->bitrate,
+        .data_bitrate = bus->data_bitrate,
+        .fd = len > 8,
+        .extended_id = CTP_ID_IS_EXTENDED(id),
+    };
+
+    return ctp_timing_frame_ns(&timing, len);
+}
+
+// Arbitration order, lower wins. The base ID is compared first, a standard
+// frame beats an extended one with the same base ID.
+static uint64_t simcan_priority(uint32_t id) {
+    if (!CTP_ID_IS_EXTENDED(id)) {
+        return (uint64_t)(id & CTP_STANDARD_ID_MAX) << 19;
+    }
+
+    return ((uint64_t)((id >> 18) & CTP_STANDARD_ID_MAX) << 19) | (1u << 18) | (id & 0x3FFFF);
+}
+
+static void simcan_deliver(SimCAN_Bus *bus, const CTP_CanFrame *frame, uint32_t sender) {
+    for (uint32_t i = 0; i < bus->node_count; i++) {
+        SimCAN_Node *node = &bus->nodes[i];
+
+        if (i == sender) {
+            continue;
+        }
+
+        if (node->listener != NULL) {
+            node->listener(node->listener_user, frame);
+            continue;
+        }
+
+        if (node->rx_count == SIMCAN_RX_QUEUE_LEN) {
+            node->overruns++;
+            continue;
+        }
+
+        node->rx[(node->rx_head + node->rx_count++) % SIMCAN_RX_QUEUE_LEN] = *frame;
+    }
+}
+
+// Transmit the frame winning arbitration and deliver it to every other node,
+// applying the configured faults. Returns false when no frame is pending.
+bool simcan_step(SimCAN_Bus *bus) {
+    SimCAN_Node *winner = NULL;
+    uint64_t best = 0;
+
+    if (bus->stepping) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < bus->node_count; i++) {
+        SimCAN_Node *node = &bus->nodes[i];
+
+        if (node->tx_count > 0) {
+            uint64_t priority = simcan_priority(node->tx[node->tx_head].id);
+
+            if (winner == NULL || priority < best) {
+                winner = node;
+                best = priority;
+            }
+        }
+    }
+
+    if (winner == NULL) {
+        // Nothing left to overtake a reordered frame, let it through
+        if (bus->holding) {
+            bus->holding = false;
+            bus->stepping = true;
+            simcan_deliver(bus, &bus->held, bus->held_sender);
+            bus->stepping = false;
+            return true;
+        }
+        return false;
+    }
+
+    CTP_CanFrame frame = winner->tx[winner->tx_head];
+    winner->tx_head = (winner->tx_head + 1) % SIMCAN_TX_QUEUE_LEN;
+    winner->tx_count--;
+
+    uint64_t ns = simcan_frame_ns(bus, frame.id, frame.len);
+    bus->now_ns += ns;
+    bus->stats.busy_ns += ns;
+    bus->stats.frames++;
+    frame.timestamp_us = bus->now_ns / 1000;
+
+    if (simcan_chance(bus, bus->faults.drop)) {
+        bus->stats.dropped++;
+        return true;
+    }
+
+    if (frame.len > 0 && simcan_chance(bus, bus->faults.corrupt)) {
+        uint32_t bit = (uint32_t)(simcan_random(bus) * frame.len * 8);
+
+        frame.data[bit / 8] ^= 1 << (bit % 8);
+        bus->stats.corrupted++;
+    }
+
+    if (!bus->holding && simcan_chance(bus, bus->faults.reorder)) {
+        bus->held = frame;
+        bus->held_sender = winner->index;
+        bus->holding = true;
+        bus->stats.reordered++;
+        return true;
+    }
+
+    bool duplicate = simcan_chance(bus, bus->faults.duplicate);
+
+    // Listeners may queue answers, but can't run the bus themselves
+    bus->stepping = true;
+    simcan_deliver(bus, &frame, winner->index);
+
+    if (duplicate) {
+        simcan_deliver(bus, &frame, winner->index);
+        bus->stats.duplicated++;
+    }
+
+    if (bus->holding) {
+        bus->holding = false;
+        simcan_deliver(bus, &bus->held, bus->held_sender);
+    }
+    bus->stepping = false;
+
+    return true;
+}
+
+// Run the bus until every node's TX queue is empty. Returns the number of steps.
+uint32_t simcan_run(SimCAN_Bus *bus) {
+    uint32_t steps = 0;
+
+    while (simcan_step(bus)) {
+        steps++;
+    }
+
+    return steps;
+}
+
+// Let us microseconds of bus time pass, transmitting what is pending meanwhile
+void simcan_advance(SimCAN_Bus *bus, uint64_t us) {
+    uint64_t target = bus->now_ns + us * 1000;
+
+    while (bus->now_ns < target && simcan_step(bus)) {
+    }
+
+    if (bus->now_ns < target) {
+        bus->now_ns = target;
+    }
+}
+
+// Queue a frame for arbitration. A full TX queue is drained onto the bus
+// first, unless the bus is already running, e.g. when a listener answers.
+static bool simcan_send(void *handle, uint32_t id, const uint8_t *data, uint8_t length) {
+    SimCAN_Node *node = handle;
+
+    while (node->tx_count == SIMCAN_TX_QUEUE_LEN) {
+        if (!simcan_step(node->bus)) {
+            return false;
+        }
+    }
+
+    CTP_CanFrame *frame = &node->tx[(node->tx_head + node->tx_count++) % SIMCAN_TX_QUEUE_LEN];
+    frame->id = id;
+    frame->len = length;
+    frame->timestamp_us = 0;
+    memcpy(frame->data, data, length);
+    return true;
+}
+
+// Run the bus until the node has a frame. An idle bus only lets a little time pass.
+static bool simcan_wait_rx(SimCAN_Node *node) {
+    while (node->rx_count == 0) {
+        if (!simcan_step(node->bus)) {
+            node->bus->now_ns += SIMCAN_IDLE_POLL_US * 1000;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint32_t simcan_receive_batch(void *handle, CTP_CanFrame *frames, uint32_t count) {
+    SimCAN_Node *node = handle;
+    uint32_t n = 0;
+
+    if (!simcan_wait_rx(node)) {
+        return 0;
+    }
+
+    while (n < count && node->rx_count > 0) {
+        frames[n++] = node->rx[node->rx_head];
+        node->rx_head = (node->rx_head + 1) % SIMCAN_RX_QUEUE_LEN;
+        node->rx_count--;
+    }
+
+    return n;
+}
+
+static bool simcan_receive(void *handle, uint32_t *id, uint8_t *data, uint8_t *length) {
+    CTP_CanFrame frame;
+
+    if (simcan_receive_batch(handle, &frame, 1) == 0) {
+        return false;
+    }
+
+    *id = frame.id;
+    *length = frame.len;
+    memcpy(data, frame.data, frame.len);
+    return true;
+}
+
+static uint64_t simcan_now_us(void *handle) {
+    SimCAN_Node *node = handle;
+
+    return node->bus->now_ns / 1000;
+}
+
+static void simcan_sleep_us(void *handle, uint32_t us) {
+    SimCAN_Node *node = handle;
+
+    simcan_advance(node->bus, us);
+}
+
+const CTP_Driver simcan_driver = {
+    .send = simcan_send,
+    .receive = simcan_receive,
+    .receive_batch = simcan_receive_batch,
+    .now_us = simcan_now_us,
+    .sleep_us = simcan_sleep_us,
+};
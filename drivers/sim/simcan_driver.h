@@ -0,0 +1,93 @@
+#ifndef SIMCAN_DRIVER_H
+#define SIMCAN_DRIVER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ctp.h"
+
+// Bus sizing, override at compile time. A node's TX queue plays the part of
+// the controller's mailboxes, its RX queue that of the receive FIFO.
+#ifndef SIMCAN_MAX_NODES
+#define SIMCAN_MAX_NODES 8
+#endif
+
+#ifndef SIMCAN_TX_QUEUE_LEN
+#define SIMCAN_TX_QUEUE_LEN 64
+#endif
+
+#ifndef SIMCAN_RX_QUEUE_LEN
+#define SIMCAN_RX_QUEUE_LEN 4096
+#endif
+
+typedef struct SimCAN_Bus SimCAN_Bus;
+
+// Takes frames delivered to a node instead of its RX queue, e.g. to run a
+// receiver inside the bus. Frames sent from the listener are queued normally.
+typedef void (*SimCAN_Listener)(void *user, const CTP_CanFrame *frame);
+
+// A node on the bus, used as the CTP driver handle
+typedef struct {
+    SimCAN_Bus *bus;
+    uint32_t index;
+    CTP_CanFrame tx[SIMCAN_TX_QUEUE_LEN];
+    uint32_t tx_head;
+    uint32_t tx_count;
+    CTP_CanFrame rx[SIMCAN_RX_QUEUE_LEN];
+    uint32_t rx_head;
+    uint32_t rx_count;
+    uint64_t overruns;                  // Frames lost to a full RX queue
+    SimCAN_Listener listener;
+    void *listener_user;
+} SimCAN_Node;
+
+// Probability of each fault per frame on the wire, 0 to 1
+typedef struct {
+    double drop;                        // No node receives the frame
+    double duplicate;                   // Every node receives it twice
+    double reorder;                     // It's delivered after the next frame
+    double corrupt;                     // One data bit is flipped
+} SimCAN_Faults;
+
+typedef struct {
+    uint64_t frames;                    // Frames that won arbitration
+    uint64_t dropped;
+    uint64_t duplicated;
+    uint64_t reordered;
+    uint64_t corrupted;
+    uint64_t busy_ns;                   // Time the bus spent transmitting
+} SimCAN_Stats;
+
+// Virtual CAN bus running in the calling thread on its own clock. Frames are
+// arbitrated by ID like on a real bus and take as long as their bits need at
+// the configured bit rates. Faults are drawn from a seeded generator, so a run
+// is reproduced exactly by the same seed. Not thread safe.
+struct SimCAN_Bus {
+    SimCAN_Node nodes[SIMCAN_MAX_NODES];
+    uint32_t node_count;
+    uint32_t bitrate;                   // Nominal bit rate, bit/s
+    uint32_t data_bitrate;              // FD data phase bit rate, 0 without bit rate switching
+    SimCAN_Faults faults;
+    SimCAN_Stats stats;
+    uint64_t now_ns;
+    uint64_t rng;
+    CTP_CanFrame held;                  // Reordered frame waiting for the next one
+    uint32_t held_sender;
+    bool holding;
+    bool stepping;
+};
+
+// Driver for a node of the simulated bus, pass a SimCAN_Node as the handle to
+// ctp_init. receive runs the bus until a frame arrives for the node or the
+// bus goes idle, now_us and sleep_us use the bus clock.
+extern const CTP_Driver simcan_driver;
+
+void init_simcan(SimCAN_Bus *bus, uint32_t node_count, uint32_t bitrate, uint32_t data_bitrate, uint64_t seed);
+SimCAN_Node *simcan_node(SimCAN_Bus *bus, uint32_t index);
+void simcan_listen(SimCAN_Node *node, SimCAN_Listener listener, void *user);
+bool simcan_step(SimCAN_Bus *bus);
+uint32_t simcan_run(SimCAN_Bus *bus);
+void simcan_advance(SimCAN_Bus *bus, uint64_t us);
+uint64_t simcan_frame_ns(const SimCAN_Bus *bus, uint32_t id, uint8_t len);
+
+#endif
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+
+#include "ctp.h"
+#include "ctp_timing.h"
+#include "simcan_driver.h"
+
+#define BITRATE 500000
+
+SimCAN_Bus bus;
+
+// Lower IDs win arbitration, nodes never receive their own frames
+bool test_arbitration() {
+    CTP_Context ctx[3];
+    CTP_CanFrame frame;
+    uint8_t data[8] = {0};
+
+    init_simcan(&bus, 3, BITRATE, 0, 1);
+    for (int i = 0; i < 3; i++) {
+        ctp_init(&ctx[i], &simcan_driver, simcan_node(&bus, i));
+    }
+
+    // 8 data bytes: 98 stuffable bits, 24 stuff bits worst case and 13 more
+    assert(simcan_frame_ns(&bus, 0x200, 8) == 135 * 2000);
+
+    ctx[1].driver->send(ctx[1].handle, 0x200, data, 8);
+    ctx[2].driver->send(ctx[2].handle, 0x100, data, 8);
+
+    assert(ctp_read_frame(&ctx[0], &frame) && frame.id == 0x100);
+    assert(frame.timestamp_us == 270);
+    assert(ctp_read_frame(&ctx[0], &frame) && frame.id == 0x200);
+    assert(frame.timestamp_us == 540);
+    assert(ctp_read_frame(&ctx[1], &frame) && frame.id == 0x100);
+    assert(!ctp_read_frame(&ctx[1], &frame));
+    assert(bus.stats.frames == 2 && bus.stats.busy_ns == 540000);
+    printf("SEQ: 1 Passed\n");
+
+    // A standard ID beats an extended one with the same base ID
+    ctx[1].driver->send(ctx[1].handle, CTP_ID_EXTENDED | 0x100 << 18, data, 8);
+    ctx[2].driver->send(ctx[2].handle, 0x100, data, 8);
+    assert(ctp_read_frame(&ctx[0], &frame) && frame.id == 0x100);
+    assert(ctp_read_frame(&ctx[0], &frame) && frame.id == (CTP_ID_EXTENDED | 0x100 << 18));
+    assert(simcan_frame_ns(&bus, CTP_ID_EXTENDED | 0x100, 8) == 160 * 2000);
+    printf("SEQ: 2 Passed\n");
+
+    return true;
+}
+
+// A CTP transfer takes as long on the virtual bus as on a real one
+bool test_ctp_transfer() {
+    CTP_Context tx_ctx;
+    CTP_Context rx_ctx;
+    uint8_t data[1000];
+    uint8_t received_data[sizeof(data)];
+    CTP_TimingEstimate estimate;
+
+    for (int i = 0; i < sizeof(data); i++) {
+        data[i] = i * 7;
+    }
+
+    init_simcan(&bus, 2, BITRATE, 0, 1);
+    ctp_init(&tx_ctx, &simcan_driver, simcan_node(&bus, 0));
+    ctp_init(&rx_ctx, &simcan_driver, simcan_node(&bus, 1));
+
+    assert(ctp_send(&tx_ctx, 0x123, data, sizeof(data), false) == sizeof(data));
+    assert(ctp_receive(&rx_ctx, received_data, sizeof(received_data), false) == sizeof(data));
+    assert(memcmp(received_data, data, sizeof(data)) == 0);
+
+    // START and 165 CONSECUTIVE frames of 8 bytes, the END frame carries 5 bytes
+    assert(bus.stats.frames == 167);
+    assert(bus.stats.busy_ns == 166 * simcan_frame_ns(&bus, 0x123, 8) + simcan_frame_ns(&bus, 0x123, 6));
+
+    // The estimate for the transfer matches the bus time it took
+    ctp_timing_estimate(&(CTP_BusTiming){.bitrate = BITRATE}, NULL, sizeof(data), &estimate);
+    assert(estimate.frames == 167 && estimate.busy_ns == bus.stats.busy_ns);
+    printf("SEQ: 1 Passed\n");
+
+    // FD with bit rate switching
+    init_simcan(&bus, 2, BITRATE, 2000000, 1);
+    ctp_init(&tx_ctx, &simcan_driver, simcan_node(&bus, 0));
+    ctp_init(&rx_ctx, &simcan_driver, simcan_node(&bus, 1));
+
+    assert(ctp_send(&tx_ctx, 0x123, data, sizeof(data), true) == sizeof(data));
+    assert(ctp_receive(&rx_ctx, received_data, sizeof(received_data), true) == sizeof(data));
+    assert(memcmp(received_data, data, sizeof(data)) == 0);
+    assert(bus.stats.frames == 17);
+    assert(bus.stats.busy_ns < 167 * simcan_frame_ns(&bus, 0x123, 8) / 5);
+
+    // The END frame carries 9 bytes, so every frame went out as an FD frame
+    ctp_timing_estimate(&(CTP_BusTiming){.bitrate = BITRATE, .data_bitrate = 2000000, .fd = true}, NULL, sizeof(data), &estimate);
+    assert(estimate.frames == 17 && estimate.busy_ns == bus.stats.busy_ns);
+    printf("SEQ: 2 Passed\n");
+
+    return true;
+}
+
+// Send frames with distinct payloads through a faulty bus and hash what arrives
+uint64_t run_faulty(uint64_t seed) {
+    CTP_Context tx_ctx;
+    CTP_Context rx_ctx;
+    CTP_CanFrame frame;
+    uint64_t hash = 14695981039346656037u;
+
+    init_simcan(&bus, 2, BITRATE, 0, seed);
+    bus.faults = (SimCAN_Faults){.drop = 0.1, .duplicate = 0.1, .reorder = 0.1, .corrupt = 0.1};
+    ctp_init(&tx_ctx, &simcan_driver, simcan_node(&bus, 0));
+    ctp_init(&rx_ctx, &simcan_driver, simcan_node(&bus, 1));
+
+    for (uint32_t i = 0; i < 500; i++) {
+        tx_ctx.driver->send(tx_ctx.handle, 0x100, (uint8_t *)&i, sizeof(i));
+    }
+
+    while (ctp_read_frame(&rx_ctx, &frame)) {
+        for (int i = 0; i < frame.len; i++) {
+            hash = (hash ^ frame.data[i]) * 1099511628211u;
+        }
+    }
+
+    return hash;
+}
+
+bool test_faults() {
+    uint64_t first = run_faulty(42);
+    SimCAN_Stats stats = bus.stats;
+
+    assert(stats.frames == 500);
+    assert(stats.dropped > 20 && stats.dropped < 80);
+    assert(stats.duplicated > 20 && stats.reordered > 20 && stats.corrupted > 20);
+    printf("SEQ: 1 Passed\n");
+
+    // The same seed reproduces the run exactly, another one doesn't
+    assert(run_faulty(42) == first);
+    assert(memcmp(&bus.stats, &stats, sizeof(stats)) == 0);
+    assert(run_faulty(43) != first);
+    printf("SEQ: 2 Passed\n");
+
+    return true;
+}
+
+CTP_Receiver receiver;
+uint32_t received_length = 0;
+
+void feed_receiver(void *user, const CTP_CanFrame *frame) {
+    // Stale duplicates may still follow the completed sequence
+    if (ctp_rx_feed(&receiver, frame->id, frame->data, frame->len) == CTP_RX_COMPLETE) {
+        received_length = receiver.received_length;
+    }
+}
+
+// Retransmission recovers duplicated and reordered frames on the fly
+bool test_retransmit() {
+    CTP_Context tx_ctx;
+    CTP_Context rx_ctx;
+    uint8_t data[3000];
+    static uint8_t received_data[sizeof(data)];
+
+    for (int i = 0; i < sizeof(data); i++) {
+        data[i] = i * 3;
+    }
+
+    init_simcan(&bus, 2, BITRATE, 0, 7);
+    bus.faults = (SimCAN_Faults){.duplicate = 0.05, .reorder = 0.05};
+    ctp_init(&tx_ctx, &simcan_driver, simcan_node(&bus, 0));
+    ctp_init(&rx_ctx, &simcan_driver, simcan_node(&bus, 1));
+
+    tx_ctx.flow_control = (CTP_FlowControl){.retransmit = true, .rx_id = 0x7E8, .timeout_us = 100000};
+    rx_ctx.flow_control = (CTP_FlowControl){.retransmit = true, .tx_id = 0x7E8};
+
+    // The receiver runs inside the bus, the sender in this thread
+    ctp_rx_init(&receiver, &rx_ctx, received_data, sizeof(received_data), false);
+    simcan_listen(simcan_node(&bus, 1), feed_receiver, NULL);
+
+    assert(ctp_send_extended(&tx_ctx, 0x123, data, sizeof(data), false, CTP_EXT_FLAG_CRC32) == sizeof(data));
+    assert(received_length == sizeof(data));
+    assert(memcmp(received_data, data, sizeof(data)) == 0);
+    assert(bus.stats.reordered > 0 && bus.stats.duplicated > 0);
+
+    return true;
+}
+
+int main() {
+    if (test_arbitration()) {
+        printf("Test Arbitration: PASSED\n");
+    } else {
+        printf("Test Arbitration: FAILED\n");
+    }
+
+    if (test_ctp_transfer()) {
+        printf("Test CTP Transfer: PASSED\n");
+    } else {
+        printf("Test CTP Transfer: FAILED\n");
+    }
+
+    if (test_faults()) {
+        printf("Test Faults: PASSED\n");
+    } else {
+        printf("Test Faults: FAILED\n");
+    }
+
+    if (test_retransmit()) {
+        printf("Test Retransmit: PASSED\n");
+    } else {
+        printf("Test Retransmit: FAILED\n");
+    }
+
+    return 0;
+}
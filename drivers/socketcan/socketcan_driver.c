@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#include "ctp.h"
+#include "ctp_log.h"
+#include "socketcan_driver.h"
+
+// Give up on a frame when the TX queue stays full this many times in a row
+#define SOCKETCAN_TX_RETRIES 100
+#define SOCKETCAN_TX_WAIT_MS 1
+
+#define SOCKETCAN_CMSG_SIZE CMSG_SPACE(sizeof(struct scm_timestamping))
+
+// Convert a CTP frame into the kernel frame layout, returns the MTU to write or
+// 0 for an FD length on a classic socket
+static size_t socketcan_encode(const SocketCAN_Channel *can, struct canfd_frame *frame, uint32_t id, const uint8_t *data, uint8_t length) {
+    frame->can_id = CTP_ID_IS_EXTENDED(id) ? (CAN_EFF_FLAG | (id & CAN_EFF_MASK)) : (id & CAN_SFF_MASK);
+    frame->__res0 = 0;
+    frame->__res1 = 0;
+
+    if (!can->fd) {
+        if (length > CAN_MAX_DLEN) {
+            return 0;
+        }
+
+        frame->len = length;
+        frame->flags = 0;
+        memcpy(frame->data, data, length);
+        return CAN_MTU;
+    }
+
+    // CAN FD only allows some payload lengths, frames are padded up to the next one
+    frame->len = ctp_dlc_to_length(ctp_length_to_dlc(length));
+    frame->flags = CANFD_BRS;
+    memcpy(frame->data, data, length);
+    memset(&frame->data[length], 0, frame->len - length);
+    return CANFD_MTU;
+}
+
+// Prefer the raw hardware timestamp, fall back to the kernel software one
+static uint64_t socketcan_timestamp(struct msghdr *msg) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            struct scm_timestamping ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+
+            const struct timespec *t = (ts.ts[2].tv_sec || ts.ts[2].tv_nsec) ? &ts.ts[2] : &ts.ts[0];
+            return (uint64_t)t->tv_sec * 1000000u + t->tv_nsec / 1000;
+        }
+    }
+
+    return 0;
+}
+
+// Returns false for frames the protocol must not see
+static bool socketcan_decode(const struct canfd_frame *frame, ssize_t nbytes, CTP_CanFrame *out) {
+    if ((nbytes != CAN_MTU && nbytes != CANFD_MTU) || (frame->can_id & (CAN_ERR_FLAG | CAN_RTR_FLAG))) {
+        return false;
+    }
+
+    out->id = (frame->can_id & CAN_EFF_FLAG) ? (CTP_ID_EXTENDED | (frame->can_id & CAN_EFF_MASK)) : frame->can_id;
+    out->len = frame->len;
+    memcpy(out->data, frame->data, frame->len);
+    return true;
+}
+
+// Wait for room in the TX queue, returns false when the error isn't a full queue
+static bool socketcan_wait_tx(SocketCAN_Channel *can) {
+    if (errno != ENOBUFS && errno != EAGAIN && errno != EINTR) {
+        return false;
+    }
+
+    struct pollfd pfd = {.fd = can->socket, .events = POLLOUT};
+    poll(&pfd, 1, SOCKETCAN_TX_WAIT_MS);
+    return true;
+}
+
+// Driver function for SocketCAN, used by the CTP to send frames to the CAN bus
+static bool socketcan_send(void *handle, uint32_t id, const uint8_t *data, uint8_t length) {
+    SocketCAN_Channel *can = handle;
+    struct canfd_frame frame;
+    size_t mtu = socketcan_encode(can, &frame, id, data, length);
+
+    if (mtu == 0) {
+        CTP_LOG_WARN("Failed to send CAN message: %u bytes on a classic CAN socket", length);
+        return false;
+    }
+
+    for (int retry = 0; retry < SOCKETCAN_TX_RETRIES; retry++) {
+        ssize_t written = write(can->socket, &frame, mtu);
+
+        if (written == (ssize_t)mtu) {
+            return true;
+        }
+
+        // A short write leaves errno as it was, only a failed one says why
+        if (written >= 0) {
+            CTP_LOG_WARN("Failed to send CAN message: wrote %zd of %zu bytes", written, mtu);
+            return false;
+        }
+
+        if (!socketcan_wait_tx(can)) {
+            break;
+        }
+    }
+
+    CTP_LOG_WARN("Failed to send CAN message: %s", strerror(errno));
+    return false;
+}
+
+// Driver function for SocketCAN, used by the CTP to get frames from the CAN bus
+static bool socketcan_receive(void *handle, uint32_t *id, uint8_t *data, uint8_t *length) {
+    SocketCAN_Channel *can = handle;
+    struct canfd_frame frame;
+    CTP_CanFrame out;
+
+    while (1) {
+        ssize_t nbytes = recv(can->socket, &frame, sizeof(frame), MSG_DONTWAIT);
+
+        if (nbytes < 0) {
+            return false;
+        }
+
+        if (socketcan_decode(&frame, nbytes, &out)) {
+            break;
+        }
+    }
+
+    *id = out.id;
+    *length = out.len;
+    memcpy(data, out.data, out.len);
+    return true;
+}
+
+// Push a burst of frames with one sendmmsg call per SOCKETCAN_BATCH_SIZE frames
+static uint32_t socketcan_send_batch(void *handle, const CTP_CanFrame *frames, uint32_t count) {
+    SocketCAN_Channel *can = handle;
+    struct canfd_frame out[SOCKETCAN_BATCH_SIZE];
+    struct iovec iov[SOCKETCAN_BATCH_SIZE];
+    struct mmsghdr msgs[SOCKETCAN_BATCH_SIZE];
+    uint32_t n = (count > SOCKETCAN_BATCH_SIZE) ? SOCKETCAN_BATCH_SIZE : count;
+
+    memset(msgs, 0, n * sizeof(msgs[0]));
+
+    for (uint32_t i = 0; i < n; i++) {
+        iov[i].iov_base = &out[i];
+        iov[i].iov_len = socketcan_encode(can, &out[i], frames[i].id, frames[i].data, frames[i].len);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+
+        // Send the frames before one that doesn't fit, it fails the next call
+        if (iov[i].iov_len == 0) {
+            if (i == 0) {
+                CTP_LOG_WARN("Failed to send CAN messages: %u bytes on a classic CAN socket", frames[i].len);
+                return 0;
+            }
+            n = i;
+        }
+    }
+
+    for (int retry = 0; retry < SOCKETCAN_TX_RETRIES; retry++) {
+        int sent = sendmmsg(can->socket, msgs, n, 0);
+
+        if (sent > 0) {
+            return sent;
+        }
+
+        if (sent == 0 || !socketcan_wait_tx(can)) {
+            break;
+        }
+    }
+
+    CTP_LOG_WARN("Failed to send CAN messages: %s", strerror(errno));
+    return 0;
+}
+
+// Drain up to count frames with one recvmmsg call, frames carry their receive timestamp
+static uint32_t socketcan_receive_batch(void *handle, CTP_CanFrame *frames, uint32_t count) {
+    SocketCAN_Channel *can = handle;
+    struct canfd_frame in[SOCKETCAN_BATCH_SIZE];
+    struct iovec iov[SOCKETCAN_BATCH_SIZE];
+    struct mmsghdr msgs[SOCKETCAN_BATCH_SIZE];
+    uint8_t control[SOCKETCAN_BATCH_SIZE][SOCKETCAN_CMSG_SIZE];
+    uint32_t n = (count > SOCKETCAN_BATCH_SIZE) ? SOCKETCAN_BATCH_SIZE : count;
+
+    memset(msgs, 0, n * sizeof(msgs[0]));
+
+    for (uint32_t i = 0; i < n; i++) {
+        iov[i].iov_base = &in[i];
+        iov[i].iov_len = sizeof(in[i]);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control[i];
+        msgs[i].msg_hdr.msg_controllen = SOCKETCAN_CMSG_SIZE;
+    }
+
+    int received = recvmmsg(can->socket, msgs, n, MSG_DONTWAIT, NULL);
+
+    if (received <= 0) {
+        return 0;
+    }
+
+    uint32_t frame_count = 0;
+
+    for (int i = 0; i < received; i++) {
+        if (socketcan_decode(&in[i], msgs[i].msg_len, &frames[frame_count])) {
+            frames[frame_count].timestamp_us = socketcan_timestamp(&msgs[i].msg_hdr);
+            frame_count++;
+        }
+    }
+
+    return frame_count;
+}
+
+static uint64_t socketcan_now_us(void *handle) {
+    (void)handle;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+static void socketcan_sleep_us(void *handle, uint32_t us) {
+    (void)handle;
+    struct timespec ts = {.tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000};
+
+    nanosleep(&ts, NULL);
+}
+
+// Split a range into aligned power of two blocks, one ID/mask filter each.
+// The mask includes CAN_EFF_FLAG, so 11 and 29 bit frames with the same ID
+// bits don't match each other's filters. Returns the new filter count, more
+// than max when the filters don't fit.
+static uint32_t socketcan_range_filters(struct can_filter *filters, uint32_t n, uint32_t max, const CTP_IdRange *range) {
+    bool extended = CTP_ID_IS_EXTENDED(range->first);
+    uint32_t id_mask = extended ? CAN_EFF_MASK : CAN_SFF_MASK;
+    uint32_t first = range->first & id_mask;
+    uint32_t last = range->last & id_mask;
+
+    while (n <= max) {
+        uint32_t size = 1;
+
+        while (size <= id_mask && (first & (2 * size - 1)) == 0 && last - first >= 2 * size - 1) {
+            size *= 2;
+        }
+
+        if (n < max) {
+            filters[n].can_id = first | (extended ? CAN_EFF_FLAG : 0);
+            filters[n].can_mask = (id_mask & ~(size - 1)) | CAN_EFF_FLAG;
+        }
+        n++;
+
+        if (last - first == size - 1) {
+            break;
+        }
+        first += size;
+    }
+
+    return n;
+}
+
+// Turn the CTP ranges into kernel filters. Ranges that need more than
+// SOCKETCAN_MAX_FILTERS open the socket up, the CTP filters in software then.
+static bool socketcan_set_filter(void *handle, const CTP_IdRange *ranges, uint32_t count) {
+    SocketCAN_Channel *can = handle;
+    struct can_filter filters[SOCKETCAN_MAX_FILTERS];
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < count && n <= SOCKETCAN_MAX_FILTERS; i++) {
+        n = socketcan_range_filters(filters, n, SOCKETCAN_MAX_FILTERS, &ranges[i]);
+    }
+
+    // An ID/mask of 0 passes every frame
+    if (count == 0 || n > SOCKETCAN_MAX_FILTERS) {
+        if (count > 0) {
+            CTP_LOG_WARN("Too many CAN filters, accepting all frames");
+        }
+
+        filters[0].can_id = 0;
+        filters[0].can_mask = 0;
+        n = 1;
+    }
+
+    return socketcan_set_filters(can, filters, n) == 0;
+}
+
+const CTP_Driver socketcan_driver = {
+    .send = socketcan_send,
+    .receive = socketcan_receive,
+    .send_batch = socketcan_send_batch,
+    .receive_batch = socketcan_receive_batch,
+    .now_us = socketcan_now_us,
+    .sleep_us = socketcan_sleep_us,
+    .set_filter = socketcan_set_filter,
+};
+
+uint32_t init_socketcan(SocketCAN_Channel *can, const char *ifname, bool fd) {
+    struct sockaddr_can addr;
+    int enable = 1;
+    int timestamping = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+                       SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+    can->fd = fd;
+    can->socket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+
+    if (can->socket < 0) {
+        CTP_LOG_ERROR("Failed to open CAN socket: %s", strerror(errno));
+        return 1;
+    }
+
+    unsigned int ifindex = if_nametoindex(ifname);
+
+    if (ifindex == 0) {
+        CTP_LOG_ERROR("Invalid interface: %s", ifname);
+        close_socketcan(can);
+        return 1;
+    }
+
+    if (fd && setsockopt(can->socket, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable)) < 0) {
+        CTP_LOG_ERROR("Interface does not support CAN FD: %s", ifname);
+        close_socketcan(can);
+        return 1;
+    }
+
+    // Timestamps are best effort, not every interface supports them
+    setsockopt(can->socket, SOL_SOCKET, SO_TIMESTAMPING, &timestamping, sizeof(timestamping));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifindex;
+
+    if (bind(can->socket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        CTP_LOG_ERROR("Failed to bind CAN socket to %s: %s", ifname, strerror(errno));
+        close_socketcan(can);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Install kernel RX filters, frames not matching any filter never reach user space.
+// A count of 0 drops every frame.
+uint32_t socketcan_set_filters(SocketCAN_Channel *can, const struct can_filter *filters, uint32_t count) {
+    if (setsockopt(can->socket, SOL_CAN_RAW, CAN_RAW_FILTER, filters, count * sizeof(struct can_filter)) < 0) {
+        CTP_LOG_ERROR("Failed to set CAN filters: %s", strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+void close_socketcan(SocketCAN_Channel *can) {
+    if (can->socket >= 0) {
+        close(can->socket);
+        can->socket = -1;
+    }
+}
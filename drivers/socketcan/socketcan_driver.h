@@ -0,0 +1,35 @@
+#ifndef SOCKETCAN_DRIVER_H
+#define SOCKETCAN_DRIVER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/can.h>
+
+#include "ctp.h"
+
+// Frames moved per recvmmsg/sendmmsg system call
+#ifndef SOCKETCAN_BATCH_SIZE
+#define SOCKETCAN_BATCH_SIZE 32
+#endif
+
+// Kernel filters the driver installs for the CTP acceptance filter
+#ifndef SOCKETCAN_MAX_FILTERS
+#define SOCKETCAN_MAX_FILTERS 256
+#endif
+
+// SocketCAN channel state, used as the CTP driver handle
+typedef struct {
+    int socket;
+    bool fd;                // CAN FD frames enabled on the socket
+} SocketCAN_Channel;
+
+// Driver for Linux SocketCAN, pass a SocketCAN_Channel as the handle to ctp_init.
+// Frames from receive_batch carry the hardware receive timestamp when the
+// interface provides one, the kernel software timestamp otherwise.
+extern const CTP_Driver socketcan_driver;
+
+uint32_t init_socketcan(SocketCAN_Channel *can, const char *ifname, bool fd);
+uint32_t socketcan_set_filters(SocketCAN_Channel *can, const struct can_filter *filters, uint32_t count);
+void close_socketcan(SocketCAN_Channel *can);
+
+#endif
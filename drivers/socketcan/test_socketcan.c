@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "ctp.h"
+#include "socketcan_driver.h"
+
+// Tests run against a virtual CAN interface:
+//   sudo ip link add dev vcan0 type vcan && sudo ip link set up vcan0
+// Set CTP_VCAN to use another interface name.
+
+const char *ifname;
+
+// Frames written by one socket are looped back to every other socket on the interface
+bool test_loopback(bool fd) {
+    SocketCAN_Channel tx_can;
+    SocketCAN_Channel rx_can;
+    CTP_Context tx_ctx;
+    CTP_Context rx_ctx;
+    uint8_t data[3000];
+    uint8_t received_data[sizeof(data)];
+
+    // Everything is queued before the receiver reads, keep it within the socket buffer
+    uint32_t length = fd ? sizeof(data) : 600;
+
+    for (int i = 0; i < sizeof(data); i++) {
+        data[i] = i * 13;
+    }
+
+    assert(init_socketcan(&tx_can, ifname, fd) == 0);
+    assert(init_socketcan(&rx_can, ifname, fd) == 0);
+    ctp_init(&tx_ctx, &socketcan_driver, &tx_can);
+    ctp_init(&rx_ctx, &socketcan_driver, &rx_can);
+
+    assert(ctp_send(&tx_ctx, 0x123, data, length, fd) == length);
+    assert(ctp_receive(&rx_ctx, received_data, length, fd) == length);
+    assert(memcmp(received_data, data, length) == 0);
+
+    close_socketcan(&tx_can);
+    close_socketcan(&rx_can);
+    return true;
+}
+
+// Kernel filters drop frames of other IDs before they reach the receiver
+bool test_filters() {
+    SocketCAN_Channel tx_can;
+    SocketCAN_Channel rx_can;
+    CTP_Context tx_ctx;
+    CTP_Context rx_ctx;
+    CTP_CanFrame frame;
+    uint8_t data[] = {0x01, 0x02, 0x03};
+    struct can_filter filter = {.can_id = 0x200, .can_mask = CAN_SFF_MASK};
+
+    assert(init_socketcan(&tx_can, ifname, false) == 0);
+    assert(init_socketcan(&rx_can, ifname, false) == 0);
+    assert(socketcan_set_filters(&rx_can, &filter, 1) == 0);
+    ctp_init(&tx_ctx, &socketcan_driver, &tx_can);
+    ctp_init(&rx_ctx, &socketcan_driver, &rx_can);
+
+    ctp_send(&tx_ctx, 0x100, data, sizeof(data), false);
+    ctp_send(&tx_ctx, 0x200, data, sizeof(data), false);
+
+    while (!ctp_read_frame(&rx_ctx, &frame)) {
+    }
+    assert(frame.id == 0x200);
+    assert(frame.timestamp_us != 0);
+
+    close_socketcan(&tx_can);
+    close_socketcan(&rx_can);
+    return true;
+}
+
+// The CTP acceptance filter becomes kernel filters, nothing is left to drop in software
+bool test_ctp_filters() {
+    SocketCAN_Channel tx_can;
+    SocketCAN_Channel rx_can;
+    CTP_Context tx_ctx;
+    CTP_Context rx_ctx;
+    CTP_CanFrame frame;
+    CTP_StatsSnapshot stats;
+    uint8_t data[] = {0x01, 0x02, 0x03};
+
+    assert(init_socketcan(&tx_can, ifname, false) == 0);
+    assert(init_socketcan(&rx_can, ifname, false) == 0);
+    ctp_init(&tx_ctx, &socketcan_driver, &tx_can);
+    ctp_init(&rx_ctx, &socketcan_driver, &rx_can);
+    assert(ctp_filter_add_range(&rx_ctx, 0x201, 0x2FF));
+
+    ctp_send(&tx_ctx, 0x100, data, sizeof(data), false);
+    ctp_send(&tx_ctx, 0x200, data, sizeof(data), false);
+    ctp_send(&tx_ctx, 0x234, data, sizeof(data), false);
+
+    while (!ctp_read_frame(&rx_ctx, &frame)) {
+    }
+    assert(frame.id == 0x234);
+
+    // 29 bit frames keep their format through the kernel and back
+    assert(ctp_filter_add(&rx_ctx, CTP_ID_EXTENDED | 0x18DA17F9));
+    ctp_send(&tx_ctx, CTP_ID_EXTENDED | 0x234, data, sizeof(data), false);
+    ctp_send(&tx_ctx, CTP_ID_EXTENDED | 0x18DA17F9, data, sizeof(data), false);
+
+    while (!ctp_read_frame(&rx_ctx, &frame)) {
+    }
+    assert(frame.id == (CTP_ID_EXTENDED | 0x18DA17F9));
+
+    ctp_stats_snapshot(&rx_ctx, &stats);
+    assert(stats.filtered == 0);
+
+    close_socketcan(&tx_can);
+    close_socketcan(&rx_can);
+    return true;
+}
+
+// FD lengths on a classic socket fail instead of going out cut to 8 bytes
+bool test_classic_length() {
+    SocketCAN_Channel can;
+    CTP_CanFrame frames[2] = {{.id = 0x123, .len = 8}, {.id = 0x123, .len = 12}};
+    uint8_t data[12] = {0};
+
+    assert(init_socketcan(&can, ifname, false) == 0);
+
+    assert(socketcan_driver.send(&can, 0x123, data, 8));
+    assert(!socketcan_driver.send(&can, 0x123, data, 12));
+    assert(socketcan_driver.send_batch(&can, frames, 2) == 1);
+    assert(socketcan_driver.send_batch(&can, &frames[1], 1) == 0);
+
+    close_socketcan(&can);
+    return true;
+}
+
+int main() {
+    SocketCAN_Channel probe;
+
+    ifname = getenv("CTP_VCAN") ? getenv("CTP_VCAN") : "vcan0";
+
+    if (init_socketcan(&probe, ifname, false) != 0) {
+        printf("%s not available, skipping SocketCAN tests\n", ifname);
+        return 0;
+    }
+    close_socketcan(&probe);
+
+    if (test_loopback(false)) {
+        printf("Test Loopback: PASSED\n");
+    } else {
+        printf("Test Loopback: FAILED\n");
+    }
+
+    if (test_loopback(true)) {
+        printf("Test Loopback FD: PASSED\n");
+    } else {
+        printf("Test Loopback FD: FAILED\n");
+    }
+
+    if (test_filters()) {
+        printf("Test Filters: PASSED\n");
+    } else {
+        printf("Test Filters: FAILED\n");
+    }
+
+    if (test_ctp_filters()) {
+        printf("Test CTP Filters: PASSED\n");
+    } else {
+        printf("Test CTP Filters: FAILED\n");
+    }
+
+    if (test_classic_length()) {
+        printf("Test Classic Length: PASSED\n");
+    } else {
+        printf("Test Classic Length: FAILED\n");
+    }
+
+    return 0;
+}
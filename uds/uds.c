@@ -1,12 +1,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
-#include <stdio.h>
 
 #include "ctp.h"
+#include "ctp_log.h"
 #include "uds.h"
 
 
+// CTP channel used to send responses
+CTP_Context *uds_ctx;
+
 uint32_t current_security_level = SECURITY_LEVEL_LOCKED;
 
 uint8_t response_buffer[1024];
@@ -21,6 +24,10 @@ SystemDatabase global_database;
 uint8_t current_session = DEFAULT_SESSION;
 
 
+void uds_init(CTP_Context *ctx) {
+    uds_ctx = ctx;
+}
+
 // Functions to interact with the database
 bool get_data_by_identifier(uint16_t identifier, uint8_t* data, uint8_t* data_length) {
     for (int i = 0; i < MAX_DATA_IDENTIFIERS; i++) {
@@ -65,28 +72,28 @@ void send_positive_response(uint8_t original_sid, uint8_t* data, uint32_t data_l
 
     if (data == NULL || data_length == 0) {
         // No data to send, just send the SID
-        ctp_send(RESPONSE_CAN_ID, response_data, 1, false);
+        ctp_send(uds_ctx, RESPONSE_CAN_ID, response_data, 1, false);
         return;
     }
 
     memcpy(response_data + 1, data, data_length);
     
     // Send the response using the CTP (CAN Transport Protocol) send function
-    ctp_send(RESPONSE_CAN_ID, response_data, sizeof(response_data), false);
+    ctp_send(uds_ctx, RESPONSE_CAN_ID, response_data, sizeof(response_data), false);
 }
 
 void send_negative_response(uint8_t original_sid, uint8_t error_code) {
     uint8_t response_data[3] = {SID_NEGATIVE_RESPONSE, original_sid, error_code};
     
     // Send the response using the CTP (CAN Transport Protocol) send function
-    ctp_send(RESPONSE_CAN_ID, response_data, sizeof(response_data), false);
+    ctp_send(uds_ctx, RESPONSE_CAN_ID, response_data, sizeof(response_data), false);
 }
 
 void send_response(uint16_t sid, uint8_t* data, uint32_t data_length) {
     // Check if data can fit in our buffer
     if (data_length + 1 > 1024) {
         // Handle error - data too large to fit in buffer
-        printf("Error: Data too large to fit in buffer.\n");
+        CTP_LOG_ERROR("Data too large to fit in buffer: %u bytes", data_length);
         return;
     }
     
@@ -95,7 +102,7 @@ void send_response(uint16_t sid, uint8_t* data, uint32_t data_length) {
     memcpy(response_buffer + 1, data, data_length);  // Copy the actual data after the SID
 
     // Send the buffer using CTP
-    ctp_send(RESPONSE_CAN_ID, response_buffer, data_length + 1, false);
+    ctp_send(uds_ctx, RESPONSE_CAN_ID, response_buffer, data_length + 1, false);
 }
 
 void handle_message(uint8_t sid, uint8_t* data, uint32_t data_length) {
@@ -190,19 +197,19 @@ void routine_control(uint16_t routine_id) {
 
 bool execute_mock_routine(uint8_t routine_id) {
     // Mock implementation of a routine.
-    printf("Executing mock routine with ID: %02X\n", routine_id);
+    CTP_LOG_DEBUG("Executing mock routine with ID: %02X", routine_id);
     // Simulate the execution of the routine. 
     // Here, we're just printing the action. In a real implementation, you'd have actual logic.
     if(routine_id == 0x01) {
-        printf("Mock Routine 1 executed.\n");
+        CTP_LOG_DEBUG("Mock Routine 1 executed.");
         return true;
     }
     else if(routine_id == 0x02) {
-        printf("Mock Routine 2 executed.\n");
+        CTP_LOG_DEBUG("Mock Routine 2 executed.");
         return true;
     }
     else {
-        printf("Unknown routine ID.\n");
+        CTP_LOG_WARN("Unknown routine ID: %02X", routine_id);
         return false;
     }
 }
@@ -218,12 +225,9 @@ void request_download(uint8_t* file_data, uint32_t file_size) {
 
 void store_file(const char* file_name, uint8_t* data, uint32_t size) {
     // Mock implementation to store a file
-    printf("Mock storing file: %s\n", file_name);
-    // Here, we're just printing the action, but in a real implementation, you'd store the data
-    for(uint16_t i = 0; i < size; i++) {
-        printf("%02X ", data[i]);
-    }
-    printf("\n");
+    CTP_LOG_DEBUG("Mock storing file: %s, %u bytes", file_name, size);
+    // Here, we're just logging the action, but in a real implementation, you'd store the data
+    CTP_LOG_HEX(CTP_LOG_LEVEL_DEBUG, "  ", data, size);
 }
 
 // This function populates the provided buffer with error codes from the system or device.
@@ -254,7 +258,7 @@ void system_reset_request() {
 }
 
 bool mock_system_reset() {
-    printf("Executing mock system reset.\n");
+    CTP_LOG_DEBUG("Executing mock system reset.");
     // Here, we're just printing the action. 
     // In a real-world scenario, this function would reset the system or perform the necessary operations.
     return true;
@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "ctp.h"
+
 
 // Assuming each identifier corresponds to a 4-byte value for simplicity
 #define MAX_IDENTIFIER_VALUE_SIZE 4
@@ -83,6 +85,7 @@ typedef struct {
 } AppLayerMessage;
 
 
+void uds_init(CTP_Context *ctx);
 void store_file(const char* file_name, uint8_t* data, uint32_t size);
 bool mock_system_reset();
 void read_error_code_information();